@@ -0,0 +1,150 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#include <glm/gtx/string_cast.hpp>
+
+#include "Circle.hpp"
+#include "NarrowPhase.hpp"
+#include "ThreadPool.hpp"
+#include "UniformGrid.hpp"
+
+// Times the parts of a step and of rendering that go through GLM. It is built once with and once without
+// VERLET_GLM_INTRINSICS (GlmBenchmarkIntrinsics and GlmBenchmark), run both to compare them. It needs neither Windows
+// nor OpenGL, the simulation is a copy of the step in Main.cpp without the parts that don't touch GLM.
+
+constexpr float FixedUpdateTime               = 1.0f / 60.0f;
+constexpr float Gravity                       = 0.1f;
+constexpr float ConstraintRadius              = 1.0f;
+constexpr std::size_t ConstraintIterations    = 8;
+constexpr std::size_t WarmUpSteps             = 120;
+constexpr std::size_t MeasuredSteps           = 240;
+constexpr std::size_t MatrixRepetitions       = 200;
+constexpr std::size_t UnprojectionRepetitions = 100000;
+
+static std::vector<Circle> CreateCircles(std::size_t count) {
+    auto randFloat = []() {
+        return static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+    };
+    Material material{};
+    std::vector<Circle> circles;
+    for (std::size_t i = 0; i < count; i++) {
+        Circle circle{};
+        circle.Radius       = randFloat() * 0.01f + 0.004f;
+        circle.Position     = { randFloat() * 1.2f - 0.6f, randFloat() * 1.2f - 0.6f };
+        circle.PrevPosition = circle.Position;
+        circle.InverseMass  = 1.0f / material.GetMass(circle.Radius);
+        circles.emplace_back(circle);
+    }
+    return circles;
+}
+
+static void Integrate(std::span<Circle> circles) {
+    for (Circle& circle : circles) {
+        glm::vec2 velocity  = circle.Position - circle.PrevPosition;
+        circle.PrevPosition = circle.Position;
+        circle.Position += velocity;
+        circle.Position.y -= Gravity * FixedUpdateTime;
+    }
+}
+
+static void Constrain(std::span<Circle> circles) {
+    for (Circle& circle : circles) {
+        if (float length = glm::length(circle.Position); length >= ConstraintRadius - circle.Radius) {
+            circle.Position /= length + circle.Radius;
+        }
+    }
+}
+
+static double GetSeconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+}
+
+int main(int argc, char** argv) {
+    std::size_t circleCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+
+#if defined(GLM_FORCE_INTRINSICS)
+    std::cout << "GLM intrinsics on, " << circleCount << " circles" << std::endl;
+#else
+    std::cout << "GLM intrinsics off, " << circleCount << " circles" << std::endl;
+#endif
+
+    // The collisions use the scalar narrow phase, the SIMD kernels don't go through GLM
+    srand(1);
+    std::vector<Circle> circles = CreateCircles(circleCount);
+    ThreadPool threads(1);
+    UniformGrid grid;
+    NarrowPhase collisions;
+    collisions.Level = SimdLevel::Scalar;
+    std::vector<CandidatePair> pairs;
+
+    std::chrono::steady_clock::duration integrateTime{};
+    std::chrono::steady_clock::duration collideTime{};
+    for (std::size_t step = 0; step < WarmUpSteps + MeasuredSteps; step++) {
+        if (step == WarmUpSteps) {
+            integrateTime = {};
+            collideTime   = {};
+        }
+        auto start = std::chrono::steady_clock::now();
+        Integrate(circles);
+        auto integrated = std::chrono::steady_clock::now();
+
+        pairs.clear();
+        grid.Build(circles, glm::vec2{ -ConstraintRadius }, glm::vec2{ ConstraintRadius }, threads);
+        grid.ForEachPair([&](std::uint32_t a, std::uint32_t b) {
+            pairs.emplace_back(CandidatePair{ a, b });
+        });
+        for (std::size_t iteration = 0; iteration < ConstraintIterations; iteration++) {
+            Constrain(circles);
+            collisions.Solve(circles, pairs);
+        }
+        auto collided = std::chrono::steady_clock::now();
+
+        integrateTime += integrated - start;
+        collideTime += collided - integrated;
+    }
+
+    // Same for both builds when GLM's SIMD paths compute the same results
+    glm::vec2 positionSum{ 0.0f };
+    for (const Circle& circle : circles) {
+        positionSum += circle.Position;
+    }
+
+    // The model matrix of every circle and the product the vertex shader would do, as in Render
+    glm::mat4 projectionMatrix = glm::orthoLH(-4.0f / 3.0f, 4.0f / 3.0f, -1.0f, 1.0f, -1.0f, 1.0f);
+    glm::mat4 viewMatrix       = glm::translate(glm::mat4(1.0f), glm::vec3(0.1f, -0.2f, 0.0f));
+    glm::vec4 matrixSum{ 0.0f };
+    auto matrixStart = std::chrono::steady_clock::now();
+    for (std::size_t repetition = 0; repetition < MatrixRepetitions; repetition++) {
+        for (const Circle& circle : circles) {
+            glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(circle.Position, 0.0f));
+            modelMatrix           = glm::scale(modelMatrix, glm::vec3(circle.Radius, circle.Radius, 0.0f));
+            matrixSum += (projectionMatrix * viewMatrix * modelMatrix)[3];
+        }
+    }
+    auto matrixTime = std::chrono::steady_clock::now() - matrixStart;
+
+    // Inverse of the view projection and the unprojection, as in GetMouseWorldPos
+    glm::vec2 unprojectionSum{ 0.0f };
+    auto unprojectionStart = std::chrono::steady_clock::now();
+    for (std::size_t repetition = 0; repetition < UnprojectionRepetitions; repetition++) {
+        glm::vec2 screenPos{ static_cast<float>(repetition % 640) / 640.0f, static_cast<float>(repetition % 480) / 480.0f };
+        glm::mat4 cameraMatrix   = glm::translate(glm::mat4(1.0f), glm::vec3(unprojectionSum * 1e-9f, 0.0f));
+        glm::mat4 viewProjection = glm::inverse(projectionMatrix * cameraMatrix);
+        unprojectionSum += glm::vec2(viewProjection * glm::vec4(screenPos * 2.0f - 1.0f, 0.0f, 1.0f));
+    }
+    auto unprojectionTime = std::chrono::steady_clock::now() - unprojectionStart;
+
+    double matrixCount = static_cast<double>(MatrixRepetitions * circles.size());
+    std::cout << "Integrate:    " << GetSeconds(integrateTime) * 1e3 / MeasuredSteps << " ms/step" << std::endl;
+    std::cout << "Collide:      " << GetSeconds(collideTime) * 1e3 / MeasuredSteps << " ms/step" << std::endl;
+    std::cout << "Matrices:     " << GetSeconds(matrixTime) * 1e9 / matrixCount << " ns/circle" << std::endl;
+    std::cout << "Unprojection: " << GetSeconds(unprojectionTime) * 1e9 / UnprojectionRepetitions << " ns" << std::endl;
+    std::cout << "Checksums:    " << glm::to_string(positionSum) << " " << glm::to_string(matrixSum) << " "
+              << glm::to_string(unprojectionSum) << std::endl;
+}
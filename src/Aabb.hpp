@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+struct Aabb {
+    glm::vec2 Min;
+    glm::vec2 Max;
+
+    bool Overlaps(const Aabb& other) const {
+        return Min.x <= other.Max.x && other.Min.x <= Max.x && Min.y <= other.Max.y && other.Min.y <= Max.y;
+    }
+
+    bool Contains(const Aabb& other) const {
+        return Min.x <= other.Min.x && Min.y <= other.Min.y && other.Max.x <= Max.x && other.Max.y <= Max.y;
+    }
+
+    float GetPerimeter() const {
+        return 2.0f * ((Max.x - Min.x) + (Max.y - Min.y));
+    }
+
+    static Aabb Union(const Aabb& a, const Aabb& b) {
+        return { glm::min(a.Min, b.Min), glm::max(a.Max, b.Max) };
+    }
+};
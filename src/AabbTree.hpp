@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Aabb.hpp"
+#include "Circle.hpp"
+
+// Broad phase that keeps a balanced bounding volume hierarchy over enlarged ("fat") boxes around the circles. A leaf is
+// only reinserted once its circle leaves the fat box, and it does not care about the spread of circle sizes.
+// The pairs of overlapping fat boxes are kept between updates, only the circles that were reinserted are queried again.
+class AabbTree {
+public:
+    static constexpr std::int32_t NullNode = -1;
+
+    // Fat boxes are grown by this fraction of the circle's radius on every side
+    float FatMarginScale = 1.0f;
+
+    void Update(std::span<const Circle> circles) {
+        MovedCircles.assign(std::max(circles.size(), CircleLeaves.size()), 0);
+        MovedList.clear();
+
+        while (CircleLeaves.size() > circles.size()) {
+            if (CircleLeaves.back() != NullNode)
+                DestroyLeaf(CircleLeaves.back());
+            MarkMoved(CircleLeaves.size() - 1);
+            CircleLeaves.pop_back();
+        }
+        CircleLeaves.resize(circles.size(), NullNode);
+
+        for (std::size_t i = 0; i < circles.size(); i++) {
+            std::int32_t& leaf   = CircleLeaves[i];
+            const Circle& circle = circles[i];
+            if (!HasCollisions(circle)) {
+                if (leaf != NullNode) {
+                    DestroyLeaf(leaf);
+                    leaf = NullNode;
+                    MarkMoved(i);
+                }
+                continue;
+            }
+
+            Aabb bounds = GetBounds(circle);
+            if (leaf == NullNode) {
+                leaf               = AllocateNode();
+                Nodes[leaf].Circle = static_cast<std::uint32_t>(i);
+            } else if (Nodes[leaf].Box.Contains(bounds)) {
+                continue;
+            } else {
+                RemoveLeaf(leaf);
+            }
+            float margin    = circle.Radius * FatMarginScale;
+            Nodes[leaf].Box = Aabb{ bounds.Min - margin, bounds.Max + margin };
+            InsertLeaf(leaf);
+            MarkMoved(i);
+        }
+
+        if (MovedList.empty())
+            return;
+
+        // Pairs only change if one of their circles was reinserted or removed
+        std::erase_if(Pairs, [&](const CandidatePair& pair) {
+            return MovedCircles[pair.A] != 0 || MovedCircles[pair.B] != 0;
+        });
+        for (std::uint32_t circleA : MovedList) {
+            if (circleA >= CircleLeaves.size() || CircleLeaves[circleA] == NullNode)
+                continue;
+            Query(Nodes[CircleLeaves[circleA]].Box, [&](std::uint32_t circleB) {
+                // When both circles moved the pair is added by the query of the one with the higher index
+                if (circleA == circleB || (MovedCircles[circleB] != 0 && circleB > circleA))
+                    return;
+                Pairs.emplace_back(CandidatePair{ std::min(circleA, circleB), std::max(circleA, circleB) });
+            });
+        }
+    }
+
+    // Calls callback(circle) for every circle whose fat box overlaps the box
+    template <typename Callback>
+    void Query(const Aabb& box, Callback&& callback) const {
+        if (Root == NullNode)
+            return;
+
+        // The tree is kept balanced, so its height stays far below this even for millions of circles
+        constexpr std::size_t MaxStackSize = 256;
+        std::int32_t stack[MaxStackSize];
+        std::size_t stackSize = 0;
+        stack[stackSize++]    = Root;
+        while (stackSize > 0) {
+            const Node& node = Nodes[stack[--stackSize]];
+            if (!node.Box.Overlaps(box))
+                continue;
+            if (node.IsLeaf()) {
+                callback(node.Circle);
+            } else {
+                stack[stackSize++] = node.Child1;
+                stack[stackSize++] = node.Child2;
+            }
+        }
+    }
+
+    // Calls callback(a, b) once for every pair of circles with overlapping fat boxes, with a < b
+    template <typename Callback>
+    void ForEachPair(Callback&& callback) const {
+        for (const CandidatePair& pair : Pairs) {
+            callback(pair.A, pair.B);
+        }
+    }
+
+    std::int32_t GetHeight() const {
+        return Root == NullNode ? 0 : Nodes[Root].Height;
+    }
+private:
+    struct Node {
+        Aabb Box;
+        std::int32_t Parent = NullNode;
+        std::int32_t Child1 = NullNode;
+        std::int32_t Child2 = NullNode;
+        std::int32_t Height = 0; // Leaves have height 0
+        std::uint32_t Circle = 0;
+
+        bool IsLeaf() const {
+            return Child1 == NullNode;
+        }
+    };
+
+    std::int32_t Root = NullNode;
+    std::vector<Node> Nodes;
+    std::vector<std::int32_t> FreeNodes;
+    std::vector<std::int32_t> CircleLeaves; // Leaf of the circle at each index, or NullNode
+    std::vector<CandidatePair> Pairs;
+    std::vector<std::uint8_t> MovedCircles;
+    std::vector<std::uint32_t> MovedList;
+
+    void MarkMoved(std::size_t circle) {
+        MovedCircles[circle] = 1;
+        MovedList.emplace_back(static_cast<std::uint32_t>(circle));
+    }
+
+    std::int32_t AllocateNode() {
+        std::int32_t index;
+        if (!FreeNodes.empty()) {
+            index = FreeNodes.back();
+            FreeNodes.pop_back();
+        } else {
+            index = static_cast<std::int32_t>(Nodes.size());
+            Nodes.emplace_back();
+        }
+        Nodes[index] = Node{};
+        return index;
+    }
+
+    void DestroyLeaf(std::int32_t leaf) {
+        RemoveLeaf(leaf);
+        FreeNodes.emplace_back(leaf);
+    }
+
+    void InsertLeaf(std::int32_t leaf) {
+        if (Root == NullNode) {
+            Root               = leaf;
+            Nodes[leaf].Parent = NullNode;
+            return;
+        }
+
+        // Walk down to the sibling that grows the total perimeter of the tree the least
+        Aabb leafBox       = Nodes[leaf].Box;
+        std::int32_t index = Root;
+        while (!Nodes[index].IsLeaf()) {
+            const Node& node      = Nodes[index];
+            float perimeter       = node.Box.GetPerimeter();
+            float combined        = Aabb::Union(node.Box, leafBox).GetPerimeter();
+            float cost            = 2.0f * combined;
+            float inheritanceCost = 2.0f * (combined - perimeter);
+
+            auto getDescendCost = [&](std::int32_t child) {
+                const Node& childNode = Nodes[child];
+                float childCombined   = Aabb::Union(childNode.Box, leafBox).GetPerimeter();
+                if (childNode.IsLeaf())
+                    return childCombined + inheritanceCost;
+                return childCombined - childNode.Box.GetPerimeter() + inheritanceCost;
+            };
+            float cost1 = getDescendCost(node.Child1);
+            float cost2 = getDescendCost(node.Child2);
+            if (cost < cost1 && cost < cost2)
+                break;
+            index = cost1 < cost2 ? node.Child1 : node.Child2;
+        }
+
+        std::int32_t sibling    = index;
+        std::int32_t oldParent  = Nodes[sibling].Parent;
+        std::int32_t newParent  = AllocateNode();
+        Nodes[newParent].Parent = oldParent;
+        Nodes[newParent].Box    = Aabb::Union(leafBox, Nodes[sibling].Box);
+        Nodes[newParent].Height = Nodes[sibling].Height + 1;
+        Nodes[newParent].Child1 = sibling;
+        Nodes[newParent].Child2 = leaf;
+        Nodes[sibling].Parent   = newParent;
+        Nodes[leaf].Parent      = newParent;
+        if (oldParent == NullNode) {
+            Root = newParent;
+        } else {
+            ReplaceChild(oldParent, sibling, newParent);
+        }
+
+        RefitAncestors(newParent);
+    }
+
+    void RemoveLeaf(std::int32_t leaf) {
+        if (leaf == Root) {
+            Root = NullNode;
+            return;
+        }
+
+        std::int32_t parent      = Nodes[leaf].Parent;
+        std::int32_t grandParent = Nodes[parent].Parent;
+        std::int32_t sibling     = Nodes[parent].Child1 == leaf ? Nodes[parent].Child2 : Nodes[parent].Child1;
+        FreeNodes.emplace_back(parent);
+        Nodes[sibling].Parent = grandParent;
+        if (grandParent == NullNode) {
+            Root = sibling;
+        } else {
+            ReplaceChild(grandParent, parent, sibling);
+            RefitAncestors(grandParent);
+        }
+    }
+
+    void ReplaceChild(std::int32_t parent, std::int32_t oldChild, std::int32_t newChild) {
+        if (Nodes[parent].Child1 == oldChild) {
+            Nodes[parent].Child1 = newChild;
+        } else {
+            Nodes[parent].Child2 = newChild;
+        }
+    }
+
+    void RefitAncestors(std::int32_t index) {
+        while (index != NullNode) {
+            index       = Balance(index);
+            Node& node  = Nodes[index];
+            node.Height = 1 + std::max(Nodes[node.Child1].Height, Nodes[node.Child2].Height);
+            node.Box    = Aabb::Union(Nodes[node.Child1].Box, Nodes[node.Child2].Box);
+            index       = node.Parent;
+        }
+    }
+
+    // Rotates the taller grandchild up if the children's heights differ by more than one, returns the subtree's new root
+    std::int32_t Balance(std::int32_t indexA) {
+        Node& a = Nodes[indexA];
+        if (a.IsLeaf() || a.Height < 2)
+            return indexA;
+
+        std::int32_t indexB  = a.Child1;
+        std::int32_t indexC  = a.Child2;
+        std::int32_t balance = Nodes[indexC].Height - Nodes[indexB].Height;
+        if (balance > 1) {
+            RotateUp(indexA, indexC, false);
+            return indexC;
+        }
+        if (balance < -1) {
+            RotateUp(indexA, indexB, true);
+            return indexB;
+        }
+        return indexA;
+    }
+
+    // Makes the child the parent of its old parent. The child's taller child stays with it, the shorter one is handed
+    // to the old parent in place of the child.
+    void RotateUp(std::int32_t indexA, std::int32_t indexChild, bool childIsChild1) {
+        Node& a     = Nodes[indexA];
+        Node& child = Nodes[indexChild];
+
+        std::int32_t indexOther   = childIsChild1 ? a.Child2 : a.Child1;
+        std::int32_t indexTaller  = child.Child1;
+        std::int32_t indexShorter = child.Child2;
+        if (Nodes[indexTaller].Height < Nodes[indexShorter].Height)
+            std::swap(indexTaller, indexShorter);
+
+        child.Parent = a.Parent;
+        a.Parent     = indexChild;
+        if (child.Parent == NullNode) {
+            Root = indexChild;
+        } else {
+            ReplaceChild(child.Parent, indexA, indexChild);
+        }
+
+        child.Child1 = indexA;
+        child.Child2 = indexTaller;
+        if (childIsChild1) {
+            a.Child1 = indexShorter;
+        } else {
+            a.Child2 = indexShorter;
+        }
+        Nodes[indexShorter].Parent = indexA;
+
+        a.Box        = Aabb::Union(Nodes[indexOther].Box, Nodes[indexShorter].Box);
+        a.Height     = 1 + std::max(Nodes[indexOther].Height, Nodes[indexShorter].Height);
+        child.Box    = Aabb::Union(a.Box, Nodes[indexTaller].Box);
+        child.Height = 1 + std::max(a.Height, Nodes[indexTaller].Height);
+    }
+};
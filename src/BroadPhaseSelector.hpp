@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <span>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "Circle.hpp"
+
+enum struct BroadPhase {
+    UniformGrid,
+    SpatialHash,
+    SweepAndPrune,
+    AabbTree,
+    HierarchicalGrid,
+    LooseQuadtree,
+    MultiBoxPruning, // Needs its regions set up for the world, so it is never picked automatically
+    AllPairs,
+};
+
+struct SceneStatistics {
+    std::size_t CircleCount = 0;
+    float MinRadius         = 0.0f;
+    float MaxRadius         = 0.0f;
+    float MeanRadius        = 0.0f;
+    float Occupancy         = 0.0f; // Area covered by the circles over the area of their bounding box
+    float Motion            = 0.0f; // Mean distance moved in the last step, in mean radii
+};
+
+// Picks a broad phase from statistics of the scene sampled every SampleInterval steps. Each rule has a band between the
+// thresholds for switching to and away from a broad phase, and a different choice has to come out of several samples in
+// a row before it is used, so scenes near a threshold don't switch back and forth.
+class BroadPhaseSelector {
+public:
+    std::size_t SampleInterval  = 30;
+    std::size_t SamplesToSwitch = 3;
+    std::size_t MaxAllPairs     = 64;    // Circle count to switch to all pairs below
+    float PolydisperseRatio     = 4.0f;  // Largest over smallest radius to switch to a multi-scale broad phase above
+    float CalmMotion            = 0.05f; // Motion to switch to sweep and prune below
+    float SparseOccupancy       = 0.01f; // Occupancy to switch to the spatial hash below
+    float Band                  = 1.5f;  // Factor a scene has to go past a threshold by to switch away again
+
+    // Returns the broad phase to use for the next step, bounded is whether a container keeps the circles together
+    BroadPhase Update(std::span<const Circle> circles, bool bounded, BroadPhase current) {
+        if (HasSampled && ++StepsSinceSample < SampleInterval)
+            return current;
+        StepsSinceSample = 0;
+
+        // Nothing was picked for the scene yet, so the first choice is used right away
+        BroadPhase choice = Choose(Measure(circles), bounded, current);
+        if (!HasSampled) {
+            HasSampled    = true;
+            PendingChoice = choice;
+            return choice;
+        }
+        if (choice == current || choice != PendingChoice) {
+            PendingChoice  = choice;
+            PendingSamples = choice == current ? 0 : 1;
+            return current;
+        }
+        if (++PendingSamples < SamplesToSwitch)
+            return current;
+        PendingSamples = 0;
+        return choice;
+    }
+
+    static SceneStatistics Measure(std::span<const Circle> circles) {
+        SceneStatistics statistics{};
+        statistics.MinRadius = std::numeric_limits<float>::max();
+        glm::vec2 boundsMin{ std::numeric_limits<float>::max() };
+        glm::vec2 boundsMax{ std::numeric_limits<float>::lowest() };
+        float radiusSum = 0.0f;
+        float area      = 0.0f;
+        float motion    = 0.0f;
+        for (const Circle& circle : circles) {
+            if (!HasCollisions(circle))
+                continue;
+            statistics.CircleCount++;
+            statistics.MinRadius = std::min(statistics.MinRadius, circle.Radius);
+            statistics.MaxRadius = std::max(statistics.MaxRadius, circle.Radius);
+            boundsMin            = glm::min(boundsMin, circle.Position - circle.Radius);
+            boundsMax            = glm::max(boundsMax, circle.Position + circle.Radius);
+            radiusSum += circle.Radius;
+            area += circle.Radius * circle.Radius * glm::pi<float>();
+            motion += glm::length(circle.Position - circle.PrevPosition);
+        }
+        if (statistics.CircleCount == 0)
+            return SceneStatistics{};
+
+        statistics.MeanRadius = radiusSum / static_cast<float>(statistics.CircleCount);
+        glm::vec2 size        = boundsMax - boundsMin;
+        statistics.Occupancy  = size.x * size.y > 0.0f ? area / (size.x * size.y) : 1.0f;
+        if (statistics.MeanRadius > 0.0f)
+            statistics.Motion = motion / static_cast<float>(statistics.CircleCount) / statistics.MeanRadius;
+        return statistics;
+    }
+private:
+    bool HasSampled              = false;
+    std::size_t StepsSinceSample = 0;
+    std::size_t PendingSamples   = 0;
+    BroadPhase PendingChoice     = BroadPhase::UniformGrid;
+
+    // The thresholds use the band when the scene is currently on the side of the broad phase they lead to
+    BroadPhase Choose(const SceneStatistics& statistics, bool bounded, BroadPhase current) const {
+        float maxAllPairs = static_cast<float>(MaxAllPairs) * (current == BroadPhase::AllPairs ? Band : 1.0f);
+        if (static_cast<float>(statistics.CircleCount) < maxAllPairs)
+            return BroadPhase::AllPairs;
+
+        // Grids and the spatial hash size their cells for the largest circle, which makes a cell hold many small circles,
+        // sweep and prune does best while the circles move little and the multi-level grid doesn't mind motion
+        bool multiScale = current == BroadPhase::SweepAndPrune || current == BroadPhase::HierarchicalGrid;
+        float ratio     = statistics.MinRadius > 0.0f ? statistics.MaxRadius / statistics.MinRadius : 1.0f;
+        if (ratio > (multiScale ? PolydisperseRatio / Band : PolydisperseRatio)) {
+            float calmMotion = current == BroadPhase::SweepAndPrune ? CalmMotion * Band : CalmMotion;
+            return statistics.Motion < calmMotion ? BroadPhase::SweepAndPrune : BroadPhase::HierarchicalGrid;
+        }
+
+        // The uniform grid needs the container for its bounds, and wastes most of its cells on a sparse scene
+        float sparseOccupancy = current == BroadPhase::SpatialHash ? SparseOccupancy * Band : SparseOccupancy;
+        if (!bounded || statistics.Occupancy < sparseOccupancy)
+            return BroadPhase::SpatialHash;
+        return BroadPhase::UniformGrid;
+    }
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include "Aabb.hpp"
+
+using MaterialIndex = std::uint16_t;
+
+// Physical parameters shared by every circle that references the material
+struct Material {
+    float Density = 1.0f;
+    // Reserved for friction, bounce and soft contacts, the solver doesn't read them yet
+    float Friction    = 0.0f;
+    float Restitution = 0.0f;
+    float Compliance  = 0.0f;
+
+    float GetMass(float radius) const {
+        return Density * glm::pi<float>() * radius * radius;
+    }
+};
+
+// Circle::RestingSteps of a circle whose island is asleep
+inline constexpr std::uint8_t AsleepSteps = 0xFF;
+
+// Only the data the solver touches lives here, everything else goes in CircleAttributes
+struct Circle {
+    glm::vec2 Position;
+    glm::vec2 PrevPosition;
+    float Radius;
+    float InverseMass;
+    MaterialIndex Material        = 0;
+    std::uint16_t CollisionLayers = 1;      // Layers the circle is in, one bit per layer
+    std::uint16_t CollisionMask   = 0xFFFF; // Layers the circle collides with
+    bool HasPhysics               = true;
+    // Steps in a row the circle has barely moved, see Islands
+    std::uint8_t RestingSteps = 0;
+};
+// Two circles per cache line, with or without GLM's aligned vector types (VERLET_GLM_INTRINSICS), which make glm::vec2
+// 8 byte aligned. The SIMD kernels in NarrowPhase also gather the fields by their offsets in floats.
+static_assert(sizeof(Circle) == 32 && alignof(Circle) <= 8);
+
+// Cold data for a circle, stored at the same index as the circle in GameState::Circles
+struct CircleAttributes {
+    glm::vec3 Color;
+    void* UserData = nullptr;
+};
+
+inline Aabb GetBounds(const Circle& circle) {
+    return { circle.Position - circle.Radius, circle.Position + circle.Radius };
+}
+
+// Circles in no layer or colliding with no layer are left out of the broad phases entirely
+inline bool HasCollisions(const Circle& circle) {
+    return circle.HasPhysics && circle.CollisionLayers != 0 && circle.CollisionMask != 0;
+}
+
+// Both circles have to be in a layer that the other one collides with
+inline bool CanCollide(const Circle& circleA, const Circle& circleB) {
+    return (circleA.CollisionLayers & circleB.CollisionMask) != 0 && (circleB.CollisionLayers & circleA.CollisionMask) != 0;
+}
+
+// Sleeping circles are skipped by the integration and the solvers until their island wakes up
+inline bool IsAsleep(const Circle& circle) {
+    return circle.RestingSteps == AsleepSteps;
+}
+
+// Stable reference to a circle that survives the circle being moved around in GameState::Circles.
+// A default constructed handle (generation 0) never refers to a circle.
+struct CircleHandle {
+    std::uint32_t Slot       = 0;
+    std::uint32_t Generation = 0;
+
+    bool operator==(const CircleHandle&) const = default;
+};
+
+// Pair of circle indices reported by a broad phase, the circles may or may not actually overlap
+struct CandidatePair {
+    std::uint32_t A;
+    std::uint32_t B;
+};
+
+// Whether the circles overlap or are less than slop apart
+inline bool IsTouching(const Circle& circleA, const Circle& circleB, float slop) {
+    glm::vec2 offset = circleB.Position - circleA.Position;
+    float distance   = circleA.Radius + circleB.Radius + slop;
+    return glm::dot(offset, offset) < distance * distance;
+}
+
+// Corrections that push two overlapping circles apart, the lighter circle takes most of it. Returns false without
+// touching the corrections when the circles don't overlap. The squared distance test is the one the SIMD kernels in
+// NarrowPhase use, so both always agree on which circles collide.
+inline bool GetCollisionCorrections(const Circle& circleA,
+                                    const Circle& circleB,
+                                    glm::vec2& correctionA,
+                                    glm::vec2& correctionB) {
+    glm::vec2 offset      = circleB.Position - circleA.Position;
+    float minimumDistance = circleA.Radius + circleB.Radius;
+    float distance2       = offset.x * offset.x + offset.y * offset.y;
+    if (!(distance2 < minimumDistance * minimumDistance))
+        return false;
+
+    float distance = glm::sqrt(distance2);
+    glm::vec2 aToB = offset / distance;
+    if (circleA.InverseMass <= circleB.InverseMass) {
+        float ratio = circleA.InverseMass / circleB.InverseMass;
+        correctionA = -aToB * (minimumDistance - distance) * (0.0f + ratio * 0.5f);
+        correctionB = aToB * (minimumDistance - distance) * (1.0f - ratio * 0.5f);
+    } else {
+        float ratio = circleB.InverseMass / circleA.InverseMass;
+        correctionA = -aToB * (minimumDistance - distance) * (1.0f - ratio * 0.5f);
+        correctionB = aToB * (minimumDistance - distance) * (0.0f + ratio * 0.5f);
+    }
+    return true;
+}
+
+// Applies the corrections right away, which makes the next pair see them (Gauss-Seidel)
+inline void ResolveCollision(Circle& circleA, Circle& circleB) {
+    glm::vec2 correctionA;
+    glm::vec2 correctionB;
+    if (GetCollisionCorrections(circleA, circleB, correctionA, correctionB)) {
+        circleA.Position += correctionA;
+        circleB.Position += correctionB;
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Circle.hpp"
+
+// Pair of circles in contact, ordered by handle slot
+struct ContactPair {
+    CircleHandle A;
+    CircleHandle B;
+
+    bool operator==(const ContactPair&) const = default;
+};
+
+// Contact changes since the events were last cleared, in the order the steps reported them
+struct ContactEvents {
+    std::vector<ContactPair> Begin;
+    std::vector<ContactPair> Persist;
+    std::vector<ContactPair> End;
+
+    void Clear() {
+        Begin.clear();
+        Persist.clear();
+        End.clear();
+    }
+};
+
+// Remembers which pairs of circles were touching in the last step, keyed by their handles so the contacts survive
+// the circles being moved around in the arrays, and turns the pairs reported in each step into begin, persist and end
+// events. A despawned circle's contacts end in the next step, with its now stale handle.
+class ContactTracker {
+public:
+    void BeginStep() {
+        Step++;
+    }
+
+    // Can be called more than once for the same pair in a step
+    void Report(CircleHandle handleA, CircleHandle handleB) {
+        if (handleB.Slot < handleA.Slot)
+            std::swap(handleA, handleB);
+        ContactPair pair{ handleA, handleB };
+
+        if ((Contacts.size() + 1) * 2 > Slots.size())
+            Rehash(std::max<std::size_t>(Slots.size() * 2, 16));
+        std::uint32_t& slot = Slots[FindSlot(pair)];
+        if (slot == EmptySlot) {
+            slot = static_cast<std::uint32_t>(Contacts.size());
+            Contacts.emplace_back(Contact{ pair, Step, Step });
+        } else {
+            Contacts[slot].LastStep = Step;
+        }
+    }
+
+    // Adds the events for the step to events and forgets the pairs that were not reported in it
+    void EndStep(ContactEvents& events) {
+        std::size_t kept = 0;
+        for (const Contact& contact : Contacts) {
+            if (contact.LastStep != Step) {
+                events.End.emplace_back(contact.Pair);
+                continue;
+            }
+            if (contact.FirstStep == Step) {
+                events.Begin.emplace_back(contact.Pair);
+            } else {
+                events.Persist.emplace_back(contact.Pair);
+            }
+            Contacts[kept++] = contact;
+        }
+        if (kept != Contacts.size()) {
+            Contacts.resize(kept);
+            Rehash(Slots.size());
+        }
+    }
+
+    std::size_t GetContactCount() const {
+        return Contacts.size();
+    }
+private:
+    static constexpr std::uint32_t EmptySlot = ~0u;
+
+    struct Contact {
+        ContactPair Pair;
+        std::uint32_t FirstStep = 0;
+        std::uint32_t LastStep  = 0;
+    };
+
+    std::uint32_t Step = 0;
+    std::vector<Contact> Contacts;
+    std::vector<std::uint32_t> Slots; // Open addressing table of indices into Contacts, at most half full
+
+    static std::uint64_t Hash(const ContactPair& pair) {
+        std::uint64_t a = (static_cast<std::uint64_t>(pair.A.Slot) << 32) | pair.A.Generation;
+        std::uint64_t b = (static_cast<std::uint64_t>(pair.B.Slot) << 32) | pair.B.Generation;
+        return (a * 0x9E3779B97F4A7C15ull) ^ (b * 0xC2B2AE3D27D4EB4Full);
+    }
+
+    // Returns the slot holding the pair, or the empty slot where it would be inserted
+    std::size_t FindSlot(const ContactPair& pair) const {
+        std::size_t mask = Slots.size() - 1;
+        std::size_t slot = static_cast<std::size_t>(Hash(pair) >> 32) & mask;
+        while (Slots[slot] != EmptySlot && Contacts[Slots[slot]].Pair != pair) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void Rehash(std::size_t capacity) {
+        capacity = std::max(std::bit_ceil(capacity), std::bit_ceil(std::max<std::size_t>(Contacts.size() * 2, 16)));
+        Slots.assign(capacity, EmptySlot);
+        for (std::size_t i = 0; i < Contacts.size(); i++) {
+            Slots[FindSlot(Contacts[i].Pair)] = static_cast<std::uint32_t>(i);
+        }
+    }
+};
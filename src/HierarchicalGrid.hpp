@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Circle.hpp"
+#include "SpatialHash.hpp"
+
+// Broad phase for scenes that mix very small and very large circles. Every level is a spatial hash with twice the cell
+// size of the level below it, and each circle is binned into the smallest level whose cells are at least as wide as it.
+// Circles are tested against their own level like in a normal grid, and against the levels with larger cells above
+// them, so small circles never have to share a cell with a large one.
+class HierarchicalGrid {
+public:
+    void Build(std::span<const Circle> circles) {
+        constexpr std::size_t MaxLevels = 32;
+
+        float minRadius = std::numeric_limits<float>::max();
+        float maxRadius = 0.0f;
+        for (const Circle& circle : circles) {
+            if (!HasCollisions(circle))
+                continue;
+            minRadius = std::min(minRadius, circle.Radius);
+            maxRadius = std::max(maxRadius, circle.Radius);
+        }
+        if (maxRadius <= 0.0f) {
+            Levels.clear();
+            return;
+        }
+        BaseCellSize           = minRadius * 2.0f;
+        std::size_t levelCount = std::min(GetLevel(maxRadius * 2.0f) + 1, MaxLevels);
+        Levels.resize(levelCount);
+        for (Level& level : Levels) {
+            level.Circles.clear();
+            level.Positions.clear();
+        }
+
+        for (std::size_t i = 0; i < circles.size(); i++) {
+            if (!HasCollisions(circles[i]))
+                continue;
+            Level& level = Levels[std::min(GetLevel(circles[i].Radius * 2.0f), levelCount - 1)];
+            level.Circles.emplace_back(static_cast<std::uint32_t>(i));
+            level.Positions.emplace_back(circles[i].Position);
+        }
+        for (std::size_t i = 0; i < Levels.size(); i++) {
+            // The top level takes everything that did not fit below it, so it is sized from the largest circle
+            float cellSize = i + 1 == Levels.size() ? std::max(GetCellSize(i), maxRadius * 2.0f) : GetCellSize(i);
+            Levels[i].Cells.Build(circles, Levels[i].Circles, cellSize);
+        }
+    }
+
+    // Calls callback(a, b) once for every pair of circles that could overlap, with a < b
+    template <typename Callback>
+    void ForEachPair(Callback&& callback) const {
+        for (std::size_t i = 0; i < Levels.size(); i++) {
+            const Level& level = Levels[i];
+            if (level.Circles.empty())
+                continue;
+            level.Cells.ForEachPair(callback);
+
+            // A circle at a lower level is at most half as wide as a cell at a higher level, so anything it overlaps
+            // there has its center in one of the 3x3 cells around it
+            for (std::size_t j = i + 1; j < Levels.size(); j++) {
+                const Level& larger = Levels[j];
+                if (larger.Circles.empty())
+                    continue;
+                for (std::size_t a = 0; a < level.Circles.size(); a++) {
+                    std::uint32_t circleA = level.Circles[a];
+                    glm::ivec2 cell       = larger.Cells.GetCell(level.Positions[a]);
+                    for (std::int32_t y = -1; y <= 1; y++) {
+                        for (std::int32_t x = -1; x <= 1; x++) {
+                            larger.Cells.ForEachCircleInCell(cell + glm::ivec2{ x, y }, [&](std::uint32_t circleB) {
+                                callback(std::min(circleA, circleB), std::max(circleA, circleB));
+                            });
+                        }
+                    }
+                }
+            }
+        }
+    }
+private:
+    struct Level {
+        std::vector<std::uint32_t> Circles;
+        std::vector<glm::vec2> Positions;
+        SpatialHash Cells;
+    };
+
+    float BaseCellSize = 1.0f;
+    std::vector<Level> Levels;
+
+    float GetCellSize(std::size_t level) const {
+        return std::ldexp(BaseCellSize, static_cast<int>(level));
+    }
+
+    std::size_t GetLevel(float diameter) const {
+        float ratio       = diameter / BaseCellSize;
+        std::size_t level = ratio > 1.0f ? static_cast<std::size_t>(std::ceil(std::log2(ratio))) : 0;
+        // log2 can round down right at a power of two
+        while (GetCellSize(level) < diameter) {
+            level++;
+        }
+        return level;
+    }
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Circle.hpp"
+
+// Groups the circles into islands of circles that touch each other, with a union-find over the touching pairs, and puts
+// an island to sleep once all of its circles have barely moved for StepsToSleep steps in a row. Sleeping circles stay
+// where they fell asleep, the solver's pushes on them are undone by GameState. An awake circle touching a sleeping
+// island joins it and wakes it in the next Update, and a sleeping circle moved from outside wakes it in WakeMoved.
+class Islands {
+public:
+    // Largest distance a circle can move in a step and still count as resting, as a fraction of its radius. Settled
+    // circles move less than a thousandth of that, piles that move more keep visibly jittering and stay awake.
+    float SleepDistanceScale  = 0.01f;
+    std::uint8_t StepsToSleep = 60;
+
+    // Once per step after the constraints are solved, pairs closer than slop join the same island
+    void Update(std::span<Circle> circles, std::span<const CandidatePair> pairs, float slop) {
+        Parents.resize(circles.size());
+        std::iota(Parents.begin(), Parents.end(), 0u);
+        for (const CandidatePair& pair : pairs) {
+            if (IsTouching(circles[pair.A], circles[pair.B], slop))
+                Union(pair.A, pair.B);
+        }
+
+        // An island has been resting for as long as its least rested circle
+        std::uint8_t stepsToSleep = std::clamp<std::uint8_t>(StepsToSleep, 1, AsleepSteps - 1);
+        IslandSteps.assign(circles.size(), AsleepSteps);
+        for (std::uint32_t i = 0; i < circles.size(); i++) {
+            Circle& circle = circles[i];
+            if (!circle.HasPhysics)
+                continue;
+
+            glm::vec2 moved     = circle.Position - circle.PrevPosition;
+            float sleepDistance = circle.Radius * SleepDistanceScale;
+            if (glm::dot(moved, moved) >= sleepDistance * sleepDistance) {
+                circle.RestingSteps = 0;
+            } else if (circle.RestingSteps < stepsToSleep) {
+                circle.RestingSteps++;
+            }
+            std::uint8_t& islandSteps = IslandSteps[Find(i)];
+            islandSteps               = std::min(islandSteps, circle.RestingSteps);
+        }
+
+        AsleepCount = 0;
+        for (std::uint32_t i = 0; i < circles.size(); i++) {
+            Circle& circle = circles[i];
+            if (!circle.HasPhysics)
+                continue;
+
+            bool asleep = IslandSteps[Find(i)] >= stepsToSleep;
+            AsleepCount += asleep ? 1 : 0;
+            if (asleep == IsAsleep(circle))
+                continue;
+            if (asleep) {
+                // Sleeping circles keep no velocity, they start from rest when they wake up
+                circle.RestingSteps = AsleepSteps;
+                circle.PrevPosition = circle.Position;
+            } else {
+                circle.RestingSteps = 0;
+            }
+            SleepChangeCount++;
+        }
+    }
+
+    // Wakes the island the circle was in at the last Update right away, instead of in the next Update, and starts the
+    // circle's count of resting steps over
+    void Wake(std::span<Circle> circles, std::uint32_t index) {
+        if (index >= circles.size())
+            return;
+        if (IsAsleep(circles[index]) && index < Parents.size()) {
+            std::uint32_t island = Find(index);
+            for (std::uint32_t i = 0; i < std::min(Parents.size(), circles.size()); i++) {
+                if (IsAsleep(circles[i]) && Find(i) == island)
+                    WakeCircle(circles[i]);
+            }
+        }
+        circles[index].RestingSteps = 0;
+    }
+
+    // Wakes the islands of the sleeping circles that were moved since the last Update
+    void WakeMoved(std::span<Circle> circles) {
+        for (std::uint32_t i = 0; i < circles.size(); i++) {
+            if (IsAsleep(circles[i]) && circles[i].Position != circles[i].PrevPosition)
+                Wake(circles, i);
+        }
+    }
+
+    void WakeAll(std::span<Circle> circles) {
+        for (Circle& circle : circles) {
+            if (IsAsleep(circle))
+                WakeCircle(circle);
+        }
+    }
+
+    // Changes whenever circles fall asleep or wake up
+    std::uint32_t GetSleepChangeCount() const {
+        return SleepChangeCount;
+    }
+
+    std::size_t GetAsleepCount() const {
+        return AsleepCount;
+    }
+private:
+    std::uint32_t SleepChangeCount = 0;
+    std::size_t AsleepCount        = 0;
+    std::vector<std::uint32_t> Parents;    // Union-find forest, the root of every island is its lowest circle index
+    std::vector<std::uint8_t> IslandSteps; // Resting steps of each island, at the index of its root
+
+    // A circle wakes up at rest, wherever it was moved to while it was asleep
+    void WakeCircle(Circle& circle) {
+        circle.RestingSteps = 0;
+        circle.PrevPosition = circle.Position;
+        SleepChangeCount++;
+        AsleepCount--;
+    }
+
+    std::uint32_t Find(std::uint32_t index) {
+        while (Parents[index] != index) {
+            Parents[index] = Parents[Parents[index]];
+            index          = Parents[index];
+        }
+        return index;
+    }
+
+    void Union(std::uint32_t a, std::uint32_t b) {
+        a = Find(a);
+        b = Find(b);
+        if (a < b) {
+            Parents[b] = a;
+        } else {
+            Parents[a] = b;
+        }
+    }
+};
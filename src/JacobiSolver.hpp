@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Circle.hpp"
+#include "ThreadPool.hpp"
+
+enum struct SolverMode {
+    GaussSeidel, // Every pair sees the corrections of the pairs before it, converges fastest
+    Jacobi,      // Every pair sees the positions from the last iteration, see JacobiSolver
+};
+
+// Jacobi iteration over the collision pairs. Every pair computes its corrections from the positions of the previous
+// iteration, and each circle then moves by the average of its corrections scaled by Relaxation. Nothing depends on the
+// order the pairs are solved in, and each circle sums its corrections in the order of the pairs, so the result is the
+// same for any number of threads.
+class JacobiSolver {
+public:
+    // Successive over-relaxation factor for the averaged corrections, above 1 makes up for the averaging
+    float Relaxation = 1.5f;
+
+    // Has to be called whenever the pairs change, before Solve
+    void SetPairs(std::span<const CandidatePair> pairs, std::size_t circleCount) {
+        Pairs.assign(pairs.begin(), pairs.end());
+        Corrections.resize(Pairs.size());
+
+        // Every circle's corrections, as indices into Corrections times two plus one for the B side of a pair
+        CircleStarts.assign(circleCount + 1, 0);
+        for (const CandidatePair& pair : Pairs) {
+            CircleStarts[pair.A + 1]++;
+            CircleStarts[pair.B + 1]++;
+        }
+        for (std::size_t i = 0; i < circleCount; i++) {
+            CircleStarts[i + 1] += CircleStarts[i];
+        }
+        CircleCorrections.resize(Pairs.size() * 2);
+        WritePositions.assign(CircleStarts.begin(), CircleStarts.end() - 1);
+        for (std::uint32_t i = 0; i < Pairs.size(); i++) {
+            CircleCorrections[WritePositions[Pairs[i].A]++] = i * 2;
+            CircleCorrections[WritePositions[Pairs[i].B]++] = i * 2 + 1;
+        }
+    }
+
+    // One iteration over all the pairs
+    void Solve(std::span<Circle> circles, ThreadPool& threads) {
+        constexpr std::size_t MinItemsPerThread = 1024;
+
+        std::size_t threadCount = std::clamp<std::size_t>(Pairs.size() / MinItemsPerThread, 1, threads.GetThreadCount());
+        threads.Run(threadCount, [&](std::size_t thread) {
+            auto [begin, end] = ThreadPool::GetChunk(Pairs.size(), threadCount, thread);
+            for (std::size_t i = begin; i < end; i++) {
+                Correction& correction = Corrections[i];
+                correction.Hit         = GetCollisionCorrections(circles[Pairs[i].A],
+                                                                 circles[Pairs[i].B],
+                                                                 correction.Offsets[0],
+                                                                 correction.Offsets[1]);
+            }
+        });
+
+        std::size_t circleCount = CircleStarts.size() - 1;
+        threadCount             = std::clamp<std::size_t>(circleCount / MinItemsPerThread, 1, threads.GetThreadCount());
+        threads.Run(threadCount, [&](std::size_t thread) {
+            auto [begin, end] = ThreadPool::GetChunk(circleCount, threadCount, thread);
+            for (std::size_t i = begin; i < end; i++) {
+                glm::vec2 offset{ 0.0f };
+                std::uint32_t hits = 0;
+                for (std::uint32_t j = CircleStarts[i]; j < CircleStarts[i + 1]; j++) {
+                    const Correction& correction = Corrections[CircleCorrections[j] / 2];
+                    if (!correction.Hit)
+                        continue;
+                    offset += correction.Offsets[CircleCorrections[j] % 2];
+                    hits++;
+                }
+                if (hits > 0)
+                    circles[i].Position += offset * (Relaxation / static_cast<float>(hits));
+            }
+        });
+    }
+private:
+    struct Correction {
+        glm::vec2 Offsets[2]; // For circle A and circle B of the pair
+        bool Hit = false;
+    };
+
+    std::vector<CandidatePair> Pairs;
+    std::vector<Correction> Corrections;     // One for every pair
+    std::vector<std::uint32_t> CircleStarts; // Index of each circle's first entry in CircleCorrections
+    std::vector<std::uint32_t> CircleCorrections;
+    std::vector<std::uint32_t> WritePositions;
+};
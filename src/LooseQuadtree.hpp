@@ -0,0 +1,264 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Aabb.hpp"
+#include "Circle.hpp"
+
+// Broad phase and spatial query structure for strongly clustered scenes. Nodes are only created where there are
+// circles, and each node's bounds are loosened to twice the size of its cell, so a circle goes straight into the
+// deepest node that fits its radius and only moves when its center leaves that node's cell.
+class LooseQuadtree {
+public:
+    static constexpr std::int32_t NullNode = -1;
+    static constexpr std::int32_t MaxDepth = 16;
+
+    // Rebuilds the tree from scratch with a root that covers all the circles
+    void Rebuild(std::span<const Circle> circles) {
+        Nodes.clear();
+        CircleNodes.assign(circles.size(), NullNode);
+        CircleBounds.resize(circles.size());
+        NextInNode.resize(circles.size());
+        PrevInNode.resize(circles.size());
+        OutsideCircles = 0;
+        EmptyNodes     = 0;
+
+        Aabb bounds{ glm::vec2{ std::numeric_limits<float>::max() }, glm::vec2{ std::numeric_limits<float>::lowest() } };
+        for (const Circle& circle : circles) {
+            if (HasCollisions(circle))
+                bounds = Aabb::Union(bounds, GetBounds(circle));
+        }
+        if (bounds.Min.x > bounds.Max.x)
+            bounds = Aabb{ glm::vec2{ -1.0f }, glm::vec2{ 1.0f } };
+        // Some room around the circles so that they don't leave the root right away
+        glm::vec2 size = bounds.Max - bounds.Min;
+        RootSize       = std::max(std::max(size.x, size.y), 1e-6f) * 1.5f;
+        RootMin        = (bounds.Min + bounds.Max) * 0.5f - RootSize * 0.5f;
+        for (std::int32_t depth = 0; depth <= MaxDepth + 1; depth++) {
+            CellSizes[depth] = std::ldexp(RootSize, -depth);
+        }
+        Nodes.emplace_back(Node{ .Cell = RootMin });
+        EmptyNodes++;
+
+        for (std::size_t i = 0; i < circles.size(); i++) {
+            if (HasCollisions(circles[i]))
+                Insert(static_cast<std::uint32_t>(i), circles[i]);
+        }
+    }
+
+    // Only moves the circles that left their node's cell, falls back to a rebuild when too many circles ended up
+    // outside the root, as those are tested against each other linearly, or when most nodes were left empty by the
+    // circles moving on, as nodes are never freed otherwise and every pass over the tree visits them
+    void Update(std::span<const Circle> circles) {
+        bool mostlyEmpty = EmptyNodes > 1 && EmptyNodes * 2 > Nodes.size();
+        if (Nodes.empty() || OutsideCircles * 64 > circles.size() || mostlyEmpty) {
+            Rebuild(circles);
+            return;
+        }
+
+        while (CircleNodes.size() > circles.size()) {
+            Remove(static_cast<std::uint32_t>(CircleNodes.size() - 1));
+            CircleNodes.pop_back();
+        }
+        CircleNodes.resize(circles.size(), NullNode);
+        CircleBounds.resize(circles.size());
+        NextInNode.resize(circles.size());
+        PrevInNode.resize(circles.size());
+
+        for (std::size_t i = 0; i < circles.size(); i++) {
+            std::uint32_t circle = static_cast<std::uint32_t>(i);
+            if (!HasCollisions(circles[i])) {
+                Remove(circle);
+                continue;
+            }
+            if (CircleNodes[i] != NullNode && IsInPlace(circle, circles[i])) {
+                CircleBounds[i] = GetBounds(circles[i]);
+                continue;
+            }
+            Remove(circle);
+            Insert(circle, circles[i]);
+        }
+    }
+
+    // Calls callback(circle) for every circle whose bounds overlap the box
+    template <typename Callback>
+    void Query(const Aabb& box, Callback&& callback) const {
+        QueryNodes(box, 0, [&](std::uint32_t circle, std::int32_t) {
+            callback(circle);
+        });
+    }
+
+    // Calls callback(a, b) once for every pair of circles with overlapping bounds, with a < b
+    template <typename Callback>
+    void ForEachPair(Callback&& callback) const {
+        // Loose bounds overlap, so a circle's partners can be anywhere in the tree, not just below its own node.
+        // Each circle only looks for partners at its own depth or deeper, the shallower circle of a pair reports it.
+        for (const Node& node : Nodes) {
+            for (std::int32_t circleA = node.FirstCircle; circleA != NullNode; circleA = NextInNode[circleA]) {
+                std::uint32_t a = static_cast<std::uint32_t>(circleA);
+                QueryNodes(CircleBounds[a], node.Depth, [&](std::uint32_t b, std::int32_t depth) {
+                    if (depth > node.Depth || a < b)
+                        callback(std::min(a, b), std::max(a, b));
+                });
+            }
+        }
+    }
+private:
+    struct Node {
+        glm::vec2 Cell{}; // Lower corner of the node's cell, the loose bounds extend half a cell further on every side
+        std::int32_t Depth       = 0;
+        std::int32_t Children[4] = { NullNode, NullNode, NullNode, NullNode };
+        std::int32_t FirstCircle = NullNode;
+        std::uint32_t SubtreeCount = 0; // Circles in this node and all of its descendants
+        std::int32_t Parent = NullNode;
+    };
+
+    glm::vec2 RootMin{};
+    float RootSize             = 1.0f;
+    std::size_t OutsideCircles = 0;
+    std::size_t EmptyNodes     = 0; // Nodes with no circles in their subtree
+    std::vector<Node> Nodes;
+    std::vector<std::int32_t> CircleNodes; // Node of the circle at each index, or NullNode
+    std::vector<Aabb> CircleBounds;
+    std::vector<std::int32_t> NextInNode;
+    std::vector<std::int32_t> PrevInNode;
+
+    float CellSizes[MaxDepth + 2] = {};
+
+    float GetCellSize(std::int32_t depth) const {
+        return CellSizes[depth];
+    }
+
+    static bool IsInCell(glm::vec2 position, glm::vec2 cell, float cellSize) {
+        return position.x >= cell.x && position.y >= cell.y && position.x < cell.x + cellSize && position.y < cell.y + cellSize;
+    }
+
+    static std::int32_t GetChildIndex(glm::vec2 position, const Node& node, float childSize) {
+        glm::vec2 center = node.Cell + childSize;
+        return (position.x >= center.x ? 1 : 0) | (position.y >= center.y ? 2 : 0);
+    }
+
+    // Deepest cell size that is still at least as wide as the circle, so the loose bounds contain it
+    std::int32_t GetTargetDepth(const Circle& circle) const {
+        if (circle.Radius <= 0.0f)
+            return MaxDepth;
+        std::int32_t depth = static_cast<std::int32_t>(std::floor(std::log2(RootSize / (circle.Radius * 2.0f))));
+        return std::clamp(depth, 0, MaxDepth);
+    }
+
+    // A circle stays put while its center is in its node's cell and its radius still matches the node's depth.
+    // Circles outside the root stay in the root until they come back.
+    bool IsInPlace(std::uint32_t circle, const Circle& data) const {
+        if (!IsInCell(data.Position, RootMin, RootSize))
+            return CircleNodes[circle] == 0 && !IsInCell(GetCenter(CircleBounds[circle]), RootMin, RootSize);
+        const Node& node = Nodes[CircleNodes[circle]];
+        return node.Depth == GetTargetDepth(data) && IsInCell(data.Position, node.Cell, GetCellSize(node.Depth));
+    }
+
+    void Insert(std::uint32_t circle, const Circle& data) {
+        std::int32_t node = 0;
+        if (IsInCell(data.Position, RootMin, RootSize)) {
+            std::int32_t targetDepth = GetTargetDepth(data);
+            while (Nodes[node].Depth < targetDepth) {
+                float childSize    = GetCellSize(Nodes[node].Depth + 1);
+                std::int32_t index = GetChildIndex(data.Position, Nodes[node], childSize);
+                if (Nodes[node].Children[index] == NullNode) {
+                    Node child{};
+                    child.Cell   = Nodes[node].Cell + glm::vec2{ index & 1, index >> 1 } * childSize;
+                    child.Depth  = Nodes[node].Depth + 1;
+                    child.Parent = node;
+                    Nodes.emplace_back(child);
+                    Nodes[node].Children[index] = static_cast<std::int32_t>(Nodes.size() - 1);
+                    EmptyNodes++;
+                }
+                node = Nodes[node].Children[index];
+            }
+        } else {
+            // Circles outside the root stay in the root, whose circles are tested against everything
+            OutsideCircles++;
+        }
+
+        CircleNodes[circle]  = node;
+        CircleBounds[circle] = GetBounds(data);
+        PrevInNode[circle]   = NullNode;
+        NextInNode[circle]   = Nodes[node].FirstCircle;
+        if (Nodes[node].FirstCircle != NullNode)
+            PrevInNode[Nodes[node].FirstCircle] = static_cast<std::int32_t>(circle);
+        Nodes[node].FirstCircle = static_cast<std::int32_t>(circle);
+        for (std::int32_t ancestor = node; ancestor != NullNode; ancestor = Nodes[ancestor].Parent) {
+            if (Nodes[ancestor].SubtreeCount++ == 0)
+                EmptyNodes--;
+        }
+    }
+
+    void Remove(std::uint32_t circle) {
+        std::int32_t node = CircleNodes[circle];
+        if (node == NullNode)
+            return;
+        if (node == 0 && !IsInCell(GetCenter(CircleBounds[circle]), RootMin, RootSize))
+            OutsideCircles--;
+
+        if (PrevInNode[circle] != NullNode) {
+            NextInNode[PrevInNode[circle]] = NextInNode[circle];
+        } else {
+            Nodes[node].FirstCircle = NextInNode[circle];
+        }
+        if (NextInNode[circle] != NullNode)
+            PrevInNode[NextInNode[circle]] = PrevInNode[circle];
+        for (std::int32_t ancestor = node; ancestor != NullNode; ancestor = Nodes[ancestor].Parent) {
+            if (--Nodes[ancestor].SubtreeCount == 0)
+                EmptyNodes++;
+        }
+        CircleNodes[circle] = NullNode;
+    }
+
+    static glm::vec2 GetCenter(const Aabb& box) {
+        return (box.Min + box.Max) * 0.5f;
+    }
+
+    // Calls callback(circle, depth) for every circle at minDepth or deeper whose bounds overlap the box
+    template <typename Callback>
+    void QueryNodes(const Aabb& box, std::int32_t minDepth, Callback&& callback) const {
+        if (Nodes.empty())
+            return;
+
+        constexpr std::size_t MaxStackSize = 4 * MaxDepth + 4;
+        std::int32_t stack[MaxStackSize];
+        std::size_t stackSize = 0;
+        stack[stackSize++]    = 0;
+        while (stackSize > 0) {
+            // The root is always visited, it also holds the circles that are outside of it
+            const Node& node = Nodes[stack[--stackSize]];
+            if (node.SubtreeCount == 0)
+                continue;
+            if (node.Depth >= minDepth) {
+                for (std::int32_t circle = node.FirstCircle; circle != NullNode; circle = NextInNode[circle]) {
+                    if (CircleBounds[circle].Overlaps(box))
+                        callback(static_cast<std::uint32_t>(circle), node.Depth);
+                }
+            }
+
+            // Child x spans [looseMin.x + x * childSize, looseMin.x + (x + 2) * childSize] on the x axis, and the same
+            // on the y axis, so the children that overlap the box are found without loading them
+            float childSize    = GetCellSize(node.Depth + 1);
+            glm::vec2 looseMin = node.Cell - childSize * 0.5f;
+            glm::bvec2 overlapsLow{ glm::lessThanEqual(box.Min, looseMin + childSize * 2.0f) &&
+                                    glm::greaterThanEqual(box.Max, looseMin) };
+            glm::bvec2 overlapsHigh{ glm::lessThanEqual(box.Min, looseMin + childSize * 3.0f) &&
+                                     glm::greaterThanEqual(box.Max, looseMin + childSize) };
+            for (std::int32_t index = 0; index < 4; index++) {
+                bool overlapsX = (index & 1) != 0 ? overlapsHigh.x : overlapsLow.x;
+                bool overlapsY = (index & 2) != 0 ? overlapsHigh.y : overlapsLow.y;
+                if (node.Children[index] != NullNode && overlapsX && overlapsY)
+                    stack[stackSize++] = node.Children[index];
+            }
+        }
+    }
+};
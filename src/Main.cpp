@@ -1,4 +1,9 @@
+#include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <span>
 #include <vector>
 
 #include <glad/gl.h>
@@ -9,6 +14,25 @@
 
 #include <Windows.h>
 
+#include "AabbTree.hpp"
+#include "BroadPhaseSelector.hpp"
+#include "Circle.hpp"
+#include "ContactTracker.hpp"
+#include "HierarchicalGrid.hpp"
+#include "Islands.hpp"
+#include "JacobiSolver.hpp"
+#include "LooseQuadtree.hpp"
+#include "MultiBoxPruning.hpp"
+#include "NarrowPhase.hpp"
+#include "NeighbourList.hpp"
+#include "PairBatching.hpp"
+#include "PairColouring.hpp"
+#include "SpatialHash.hpp"
+#include "StaticGeometry.hpp"
+#include "SweepAndPrune.hpp"
+#include "ThreadPool.hpp"
+#include "UniformGrid.hpp"
+
 #define GLUE_(x, y) x##y
 #define GLUE(x, y)  GLUE_(x, y)
 
@@ -32,18 +56,30 @@ enum struct MouseButton {
     Right,
 };
 
-struct Circle {
-    glm::vec2 Position;
-    glm::vec2 PrevPosition;
-    float Radius;
-    float Mass;
-    glm::vec3 Color;
-    bool HasPhysics = true;
-};
-
 class GameState {
 public:
     bool Running = true;
+    // Without the container circles can drift arbitrarily far, which only the spatial hash can deal with
+    bool HasContainer              = true;
+    BroadPhase CollisionBroadPhase = BroadPhase::UniformGrid;
+    // Replaces CollisionBroadPhase with a pick based on the scene every few steps
+    bool AutoBroadPhase = true;
+    // Reuses the candidate pairs over iterations and steps, which only pays off while most circles move slowly. Off by
+    // default, it was only measured faster for small scenes (300 circles) and slower once a pile keeps moving.
+    bool UseNeighbourList = false;
+    // Keeps the uniform grid's cells between builds and only moves the circles that changed cell, see GetGridMetrics.
+    // Off by default, it showed no gain over a full build yet.
+    bool IncrementalGrid = false;
+    // Solves the collisions on all threads, in batches of pairs that share no circles. This changes the order the pairs
+    // are solved in, and the speedup hasn't been measured on a multicore machine yet, so it is off by default.
+    bool ParallelCollisions = false;
+    // Jacobi gives the same result on any number of threads but needs more iterations than Gauss-Seidel to settle
+    SolverMode CollisionSolver = SolverMode::GaussSeidel;
+    // Tracks which circles touch from step to step, see GetContactEvents
+    bool ReportContacts = false;
+    // Puts islands of resting circles to sleep, which skips them until something pushes them or comes to rest on them.
+    // Off by default, it costs a contact pass every step and only scenes whose circles come fully to rest make up for it.
+    bool AllowSleeping = false;
 
     void Init() {
         GLuint vertexArray;
@@ -51,15 +87,21 @@ public:
         glBindVertexArray(vertexArray);
 
         CircleShader = CreateShaderProgram(CircleVertexSource, CircleFragmentSource);
+        StaticShader = CreateShaderProgram(StaticVertexSource, StaticFragmentSource);
+
+        DefaultMaterial = AddMaterial(Material{});
 
         // Background
-        Circles.emplace_back(Circle{
-            .Position     = { 0.0f, 0.0f },
-            .PrevPosition = { 0.0f, 0.0f },
-            .Radius       = 1.0f,
-            .Color        = { 0.4f, 0.4f, 0.4f },
-            .HasPhysics   = false,
-        });
+        AddCircle(
+            Circle{
+                .Position     = { 0.0f, 0.0f },
+                .PrevPosition = { 0.0f, 0.0f },
+                .Radius       = 1.0f,
+                .HasPhysics   = false,
+            },
+            CircleAttributes{
+                .Color = { 0.4f, 0.4f, 0.4f },
+            });
 
         for (std::size_t i = 0; i < 50; i++) {
             auto randFloat = []() {
@@ -67,26 +109,205 @@ public:
             };
             Circle circle{};
             circle.Radius       = randFloat() * 0.1f + 0.01f;
-            circle.Mass         = glm::pi<float>() * circle.Radius * circle.Radius;
+            circle.Material     = DefaultMaterial;
             circle.Position     = { randFloat() - 0.5f, randFloat() - 0.5f },
             circle.PrevPosition = circle.Position - glm::vec2{ randFloat() - 0.5f, randFloat() - 0.5f } * 0.02f;
-            circle.Color        = { randFloat(), randFloat(), randFloat() };
-            Circles.emplace_back(circle);
+            CircleAttributes attributes{};
+            attributes.Color = { randFloat(), randFloat(), randFloat() };
+            AddCircle(circle, attributes);
         }
+
+        // Static shapes for the circles to pile up on
+        AddStaticSegment({ -0.75f, -0.2f }, { -0.2f, -0.45f }, 0.01f);
+        AddStaticSegment({ 0.2f, -0.45f }, { 0.75f, -0.2f }, 0.01f);
+        AddStaticCircle({ 0.0f, -0.7f }, 0.08f);
+        glm::vec2 triangle[] = { { -0.1f, 0.55f }, { 0.1f, 0.55f }, { 0.0f, 0.4f } };
+        AddStaticPolygon(triangle);
     }
 
     void DeInit() {
         glDeleteProgram(CircleShader);
+        glDeleteProgram(StaticShader);
+    }
+
+    MaterialIndex AddMaterial(const Material& material) {
+        assert(Materials.size() <= std::numeric_limits<MaterialIndex>::max() && "Too many materials for MaterialIndex");
+        Materials.emplace_back(material);
+        return static_cast<MaterialIndex>(Materials.size() - 1);
+    }
+
+    // The inverse mass is derived from the circle's radius and material here, it does not need to be set by the caller.
+    // New circles always start awake.
+    CircleHandle AddCircle(Circle circle, const CircleAttributes& attributes) {
+        circle.InverseMass  = circle.HasPhysics ? 1.0f / Materials[circle.Material].GetMass(circle.Radius) : 0.0f;
+        circle.RestingSteps = 0;
+
+        CircleHandle handle{};
+        if (!FreeHandleSlots.empty()) {
+            handle.Slot = FreeHandleSlots.back();
+            FreeHandleSlots.pop_back();
+        } else {
+            handle.Slot = static_cast<std::uint32_t>(HandleSlots.size());
+            HandleSlots.emplace_back(HandleSlot{});
+        }
+        HandleSlot& slot  = HandleSlots[handle.Slot];
+        handle.Generation = slot.Generation;
+
+        // Fill a hole left by a despawned circle before growing the arrays
+        std::uint32_t index = TakeCircleHole();
+        if (index == static_cast<std::uint32_t>(Circles.size())) {
+            Circles.emplace_back(circle);
+            Attributes.emplace_back(attributes);
+            CircleHandles.emplace_back(handle);
+        } else {
+            Circles[index]       = circle;
+            Attributes[index]    = attributes;
+            CircleHandles[index] = handle;
+        }
+        slot.CircleIndex = index;
+        Neighbours.Invalidate();
+        return handle;
+    }
+
+    // Leaves a hole in the circle arrays, which CompactCircles fills over the next few steps
+    void DespawnCircle(CircleHandle handle) {
+        if (GetCircle(handle) == nullptr)
+            return;
+
+        HandleSlot& slot    = HandleSlots[handle.Slot];
+        std::uint32_t index = slot.CircleIndex;
+        // The circles resting on it have to fall
+        CircleIslands.Wake(Circles, index);
+        // Clearing HasPhysics keeps the simulation from touching the hole without an extra check
+        Circles[index].HasPhysics = false;
+        CircleHandles[index]      = CircleHandle{};
+        CircleHoles.emplace_back(index);
+
+        if (++slot.Generation == 0)
+            slot.Generation = 1;
+        FreeHandleSlots.emplace_back(handle.Slot);
+        Neighbours.Invalidate();
+    }
+
+    // Static shapes never move and are not circles, so they have no handles and can't be removed
+    void AddStaticSegment(glm::vec2 a, glm::vec2 b, float radius = 0.0f) {
+        Statics.AddSegment(a, b, radius);
+    }
+
+    void AddStaticCircle(glm::vec2 center, float radius) {
+        Statics.AddCircle(center, radius);
+    }
+
+    void AddStaticPolygon(std::span<const glm::vec2> points, float radius = 0.0f) {
+        Statics.AddPolygon(points, radius);
+    }
+
+    // Contact changes over the steps of the last Update
+    const ContactEvents& GetContactEvents() const {
+        return StepContactEvents;
+    }
+
+    const UniformGrid::UpdateMetrics& GetGridMetrics() const {
+        return CollisionBroadPhases.Grid.GetMetrics();
+    }
+
+    // Its Bounds and RegionsPerAxis have to be set up for the world when there is no container
+    MultiBoxPruning& GetMultiBoxPruning() {
+        return CollisionBroadPhases.MultiBox;
+    }
+
+    Circle* GetCircle(CircleHandle handle) {
+        if (handle.Slot >= HandleSlots.size() || HandleSlots[handle.Slot].Generation != handle.Generation)
+            return nullptr;
+        return &Circles[HandleSlots[handle.Slot].CircleIndex];
+    }
+
+    // A sleeping circle that is moved wakes its island in the next step anyway, this wakes it right away and starts the
+    // circle's count of resting steps over
+    void WakeCircle(CircleHandle handle) {
+        if (GetCircle(handle) != nullptr)
+            CircleIslands.Wake(Circles, HandleSlots[handle.Slot].CircleIndex);
+    }
+
+    // The circle under the position with the nearest center. A linear scan, as picking only happens on clicks and has
+    // to find every circle with physics, including the ones that no broad phase holds because they collide with nothing.
+    CircleHandle FindCircleAt(glm::vec2 position) {
+        CircleHandle found{};
+        float foundDistance = 0.0f;
+        for (std::size_t i = 0; i < Circles.size(); i++) {
+            const Circle& circle = Circles[i];
+            if (!circle.HasPhysics)
+                continue;
+            float distance = glm::length(circle.Position - position);
+            if (distance <= circle.Radius && (found.Generation == 0 || distance < foundDistance)) {
+                found         = CircleHandles[i];
+                foundDistance = distance;
+            }
+        }
+        return found;
+    }
+
+    // Moves live circles from the end of the arrays into holes until there are no holes left or the budget runs out,
+    // so that the cost of iterating the circles tracks the number of live circles
+    void CompactCircles(std::chrono::steady_clock::duration budget) {
+        constexpr std::size_t MovesPerClockCheck = 64;
+
+        auto deadline     = std::chrono::steady_clock::now() + budget;
+        std::size_t moves = 0;
+        while (!CircleHoles.empty()) {
+            if (Circles.empty()) {
+                CircleHoles.clear();
+                break;
+            }
+
+            // Dead circles at the end can be dropped, their entries in CircleHoles are discarded below
+            if (CircleHandles.back().Generation == 0) {
+                Neighbours.Invalidate();
+                Circles.pop_back();
+                Attributes.pop_back();
+                CircleHandles.pop_back();
+                continue;
+            }
+
+            std::uint32_t hole = CircleHoles.back();
+            CircleHoles.pop_back();
+            if (hole >= Circles.size() || CircleHandles[hole].Generation != 0)
+                continue;
+
+            Neighbours.Invalidate();
+            Circles[hole]       = Circles.back();
+            Attributes[hole]    = Attributes.back();
+            CircleHandles[hole] = CircleHandles.back();
+            Circles.pop_back();
+            Attributes.pop_back();
+            CircleHandles.pop_back();
+            HandleSlots[CircleHandles[hole].Slot].CircleIndex = hole;
+
+            if (++moves % MovesPerClockCheck == 0 && std::chrono::steady_clock::now() >= deadline)
+                break;
+        }
     }
 
     void Update(float dt) {
         time += dt;
-        constexpr float FixedUpdateTime = 1.0f / 60.0f;
-        constexpr float Gravity         = 0.1f;
+        constexpr float FixedUpdateTime  = 1.0f / 60.0f;
+        constexpr float Gravity          = 0.1f;
+        constexpr float ConstraintRadius = 1.0f;
+        constexpr auto CompactionBudget  = std::chrono::microseconds(100);
+        constexpr float ContactSlop      = 0.001f;
+        StepContactEvents.Clear();
         while (time >= FixedUpdateTime) {
+            // A held circle never rests, and sleeping circles moved from outside wake their islands. This has to happen
+            // before the compaction moves circles away from the indices the islands were found for.
+            WakeCircle(SelectedCircle);
+            CircleIslands.WakeMoved(Circles);
+            CompactCircles(CompactionBudget);
+            if (AutoBroadPhase)
+                CollisionBroadPhase = BroadPhaseSelection.Update(Circles, HasContainer, CollisionBroadPhase);
+
             for (std::size_t i = 0; i < Circles.size(); i++) {
                 Circle& circle = Circles[i];
-                if (!circle.HasPhysics)
+                if (!circle.HasPhysics || IsAsleep(circle))
                     continue;
 
                 glm::vec2 velocity  = circle.Position - circle.PrevPosition;
@@ -97,43 +318,77 @@ public:
                 circle.Position.y -= Gravity * FixedUpdateTime;
             }
 
-            constexpr std::size_t ConstraintIterations = 8;
-            for (std::size_t constraintIteration = 0; constraintIteration < ConstraintIterations; constraintIteration++) {
-                if (SelectedCircle != nullptr) {
-                    SelectedCircle->Position = GetMouseWorldPos() + SelectedCircleOffset;
-                }
-
+            // Static shapes near each circle, found once per step with a margin of the circle's radius for the distance
+            // it can still be pushed during the constraint iterations
+            StaticCandidates.clear();
+            if (!Statics.IsEmpty()) {
+                Statics.Build();
                 for (std::size_t i = 0; i < Circles.size(); i++) {
-                    Circle& circleA = Circles[i];
-                    if (!circleA.HasPhysics)
+                    const Circle& circle = Circles[i];
+                    if (!HasCollisions(circle) || IsAsleep(circle))
                         continue;
 
-                    // Constraint
-                    constexpr float ConstraintRadius = 1.0f;
-                    if (float length = glm::length(circleA.Position); length >= ConstraintRadius - circleA.Radius) {
-                        circleA.Position /= length + circleA.Radius;
-                    }
+                    Aabb bounds = GetBounds(circle);
+                    bounds.Min -= circle.Radius;
+                    bounds.Max += circle.Radius;
+                    Statics.Query(bounds, [&](std::uint32_t shape) {
+                        StaticCandidates.emplace_back(StaticCandidate{ static_cast<std::uint32_t>(i), shape });
+                    });
+                }
+            }
+
+            constexpr std::size_t ConstraintIterations = 8;
+            for (std::size_t constraintIteration = 0; constraintIteration < ConstraintIterations; constraintIteration++) {
+                if (Circle* selectedCircle = GetCircle(SelectedCircle); selectedCircle != nullptr) {
+                    MoveSelectedCircle(*selectedCircle, GetMouseWorldPos() + SelectedCircleOffset);
+                }
 
-                    for (std::size_t j = i + 1; j < Circles.size(); j++) {
-                        Circle& circleB = Circles[j];
-                        if (!circleA.HasPhysics)
+                if (HasContainer) {
+                    for (std::size_t i = 0; i < Circles.size(); i++) {
+                        Circle& circle = Circles[i];
+                        if (!circle.HasPhysics || IsAsleep(circle))
                             continue;
 
-                        float minimumDistance = circleA.Radius + circleB.Radius;
-                        if (float distance = glm::length(circleB.Position - circleA.Position); distance < minimumDistance) {
-                            glm::vec2 aToB = glm::normalize(circleB.Position - circleA.Position);
-                            if (circleA.Mass >= circleB.Mass) {
-                                float ratio = circleB.Mass / circleA.Mass;
-                                circleA.Position -= aToB * (minimumDistance - distance) * (0.0f + ratio * 0.5f);
-                                circleB.Position += aToB * (minimumDistance - distance) * (1.0f - ratio * 0.5f);
-                            } else {
-                                float ratio = circleA.Mass / circleB.Mass;
-                                circleA.Position -= aToB * (minimumDistance - distance) * (1.0f - ratio * 0.5f);
-                                circleB.Position += aToB * (minimumDistance - distance) * (0.0f + ratio * 0.5f);
-                            }
+                        // Constraint
+                        if (float length = glm::length(circle.Position); length >= ConstraintRadius - circle.Radius) {
+                            circle.Position /= length + circle.Radius;
                         }
                     }
                 }
+
+                // Static geometry
+                for (const StaticCandidate& candidate : StaticCandidates) {
+                    ResolveStaticCollision(Circles[candidate.Circle], Statics.GetShape(candidate.Shape));
+                }
+
+                // Collisions
+                SolveCollisions(ConstraintRadius);
+
+                // Sleeping circles don't move, they only wake up once the circles pushing them join their island
+                for (std::uint32_t index : PushedSleepingCircles) {
+                    Circles[index].Position = Circles[index].PrevPosition;
+                }
+            }
+
+            // Pairs closer than the slop once the constraints are solved
+            std::span<const CandidatePair> contactPairs;
+            if (ReportContacts || AllowSleeping)
+                contactPairs = FindContactPairs(ConstraintRadius, ContactSlop);
+
+            // Contacts
+            if (ReportContacts) {
+                Contacts.BeginStep();
+                for (const CandidatePair& pair : contactPairs) {
+                    if (IsTouching(Circles[pair.A], Circles[pair.B], ContactSlop))
+                        Contacts.Report(CircleHandles[pair.A], CircleHandles[pair.B]);
+                }
+                Contacts.EndStep(StepContactEvents);
+            }
+
+            if (AllowSleeping) {
+                CircleIslands.Update(Circles, contactPairs, ContactSlop);
+            } else {
+                CircleIslands.WakeAll(Circles);
             }
 
             time -= FixedUpdateTime;
@@ -149,11 +404,28 @@ public:
         glUseProgram(CircleShader);
         glProgramUniformMatrix4fv(CircleShader, ProjectionMatrixLocation, 1, GL_FALSE, glm::value_ptr(ProjectionMatrix));
         glProgramUniformMatrix4fv(CircleShader, ViewMatrixLocation, 1, GL_FALSE, glm::value_ptr(viewMatrix));
-        for (const auto& circle : Circles) {
+        for (std::size_t i = 0; i < Circles.size(); i++) {
+            if (CircleHandles[i].Generation == 0)
+                continue;
+            const Circle& circle               = Circles[i];
+            const CircleAttributes& attributes = Attributes[i];
+
             glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(circle.Position, 0.0f));
             modelMatrix           = glm::scale(modelMatrix, glm::vec3(circle.Radius, circle.Radius, 0.0f));
             glProgramUniformMatrix4fv(CircleShader, ModelMatrixLocation, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-            glProgramUniform4f(CircleShader, ColorLocation, circle.Color.r, circle.Color.g, circle.Color.b, 1.0f);
+            glProgramUniform4f(CircleShader, ColorLocation, attributes.Color.r, attributes.Color.g, attributes.Color.b, 1.0f);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+
+        // Lines have no thickness, they are drawn this thick so they can be seen
+        constexpr float MinStaticRadius = 0.003f;
+        glUseProgram(StaticShader);
+        glProgramUniformMatrix4fv(StaticShader, ProjectionMatrixLocation, 1, GL_FALSE, glm::value_ptr(ProjectionMatrix));
+        glProgramUniformMatrix4fv(StaticShader, ViewMatrixLocation, 1, GL_FALSE, glm::value_ptr(viewMatrix));
+        glProgramUniform4f(StaticShader, ColorLocation, 0.8f, 0.8f, 0.8f, 1.0f);
+        for (const StaticShape& shape : Statics.GetShapes()) {
+            glProgramUniform4f(StaticShader, SegmentLocation, shape.A.x, shape.A.y, shape.B.x, shape.B.y);
+            glProgramUniform1f(StaticShader, RadiusLocation, std::max(shape.Radius, MinStaticRadius));
             glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
         }
     }
@@ -175,18 +447,18 @@ public:
     void OnMouseButton(MouseButton button, bool pressed) {
         if (button == MouseButton::Left) {
             if (pressed) {
-                for (Circle& circle : Circles) {
-                    if (!circle.HasPhysics)
-                        continue;
-                    glm::vec2 difference = circle.Position - GetMouseWorldPos();
-                    if (glm::length(difference) <= circle.Radius) {
-                        SelectedCircle       = &circle;
-                        SelectedCircleOffset = difference;
-                        break;
-                    }
+                glm::vec2 mouseWorldPos = GetMouseWorldPos();
+                SelectedCircle          = FindCircleAt(mouseWorldPos);
+                if (Circle* selectedCircle = GetCircle(SelectedCircle); selectedCircle != nullptr) {
+                    SelectedCircleOffset = selectedCircle->Position - mouseWorldPos;
                 }
+                WakeCircle(SelectedCircle);
             } else {
-                SelectedCircle = nullptr;
+                SelectedCircle = CircleHandle{};
+            }
+        } else if (button == MouseButton::Right) {
+            if (pressed) {
+                DespawnCircle(FindCircleAt(GetMouseWorldPos()));
             }
         }
     }
@@ -203,10 +475,269 @@ private:
     glm::vec2 CameraPosition;
     float CameraScale = 1;
     std::vector<Circle> Circles;
+    std::vector<CircleAttributes> Attributes;
+    std::vector<CircleHandle> CircleHandles; // Handle of the circle at each index, or a null handle for holes
+    std::vector<std::uint32_t> CircleHoles;  // May contain stale entries, always check CircleHandles before using one
+    std::vector<Material> Materials;
+    ThreadPool Threads;
+    // Most broad phases keep state from one update to the next, so the collision and the contact pass each have their
+    // own and don't undo each other's
+    struct BroadPhaseSet {
+        UniformGrid Grid;
+        SpatialHash Hash;
+        SweepAndPrune Sweep;
+        AabbTree Tree;
+        HierarchicalGrid MultiLevelGrid;
+        LooseQuadtree Quadtree;
+        MultiBoxPruning MultiBox;
+    };
+    BroadPhaseSet CollisionBroadPhases;
+    BroadPhaseSet ContactBroadPhases;
+    NeighbourList Neighbours;
+    NeighbourList ContactNeighbours; // Rebuilt with the contact slop as its skin when Neighbours can't be used
+    std::vector<CandidatePair> CollisionPairs; // Broad phase output for when the neighbour list is off
+    NarrowPhase Collisions;
+    PairColouring PairColours;
+    PairBatching PairBatches;
+    JacobiSolver Jacobi;
+    Islands CircleIslands;
+    std::vector<CandidatePair> AwakePairs;            // Collision pairs with at least one awake circle
+    std::span<const CandidatePair> FilteredPairs;     // AwakePairs, or all the collision pairs while no circle is asleep
+    std::vector<std::uint32_t> PushedSleepingCircles; // Sleeping circles in AwakePairs, moved back after every solve
+    std::uint32_t AwakePairsVersion = 0;              // Changes whenever AwakePairs are filtered again, never 0 after that
+    std::uint32_t AwakeRebuild      = 0;              // Neighbour list rebuild AwakePairs were filtered for
+    std::uint32_t AwakeSleepChanges = 0;
+    // Version of AwakePairs the colours, batches and the Jacobi solver were set up for, 0 when they weren't set up yet
+    std::uint32_t ColouredVersion = 0;
+    std::uint32_t BatchedVersion  = 0;
+    std::uint32_t JacobiVersion   = 0;
+    std::uint32_t SolvedVersion   = 0; // Version of AwakePairs the last SolveCollisions solved
+    StaticGeometry Statics;
+    BroadPhaseSelector BroadPhaseSelection;
+    ContactTracker Contacts;
+    ContactEvents StepContactEvents;
+    MaterialIndex DefaultMaterial;
     GLuint CircleShader;
-    Circle* SelectedCircle = nullptr;
+    GLuint StaticShader;
+    CircleHandle SelectedCircle;
     glm::vec2 SelectedCircleOffset;
 
+    struct StaticCandidate {
+        std::uint32_t Circle = 0;
+        std::uint32_t Shape  = 0;
+    };
+    std::vector<StaticCandidate> StaticCandidates;
+
+    struct HandleSlot {
+        std::uint32_t CircleIndex = 0;
+        std::uint32_t Generation  = 1;
+    };
+    std::vector<HandleSlot> HandleSlots;
+    std::vector<std::uint32_t> FreeHandleSlots;
+
+    // With the neighbour list the broad phase only runs again once a circle moved too far for the list to be valid,
+    // otherwise it runs every time because the circles moved since the last call
+    std::span<const CandidatePair> FindCollisionPairs(float containerRadius) {
+        if (!UseNeighbourList) {
+            Neighbours.Invalidate();
+            CollisionPairs.clear();
+            ForEachCandidatePair(CollisionBroadPhases, Circles, containerRadius, [&](std::uint32_t a, std::uint32_t b) {
+                CollisionPairs.emplace_back(CandidatePair{ a, b });
+            });
+            return CollisionPairs;
+        }
+        if (Neighbours.NeedsRebuild(Circles)) {
+            Neighbours.Rebuild(Circles, [&](std::span<const Circle> circles, auto&& pairCallback) {
+                ForEachCandidatePair(CollisionBroadPhases, circles, containerRadius, pairCallback);
+            });
+        }
+        return Neighbours.GetPairs();
+    }
+
+    // The neighbour list's pairs hold the contacts as long as enough of its skin is left. Otherwise the collision pairs
+    // come from the circles' exact bounds and can miss circles that are within the slop without touching, so these come
+    // from a broad phase run on the circles grown by half the slop, which every broad phase reports all the overlaps of.
+    std::span<const CandidatePair> FindContactPairs(float containerRadius, float slop) {
+        if (UseNeighbourList && Neighbours.Covers(Circles, slop))
+            return Neighbours.GetPairs();
+
+        MultiBoxPruning& multiBox = ContactBroadPhases.MultiBox;
+        multiBox.Bounds           = CollisionBroadPhases.MultiBox.Bounds;
+        multiBox.RegionsPerAxis   = CollisionBroadPhases.MultiBox.RegionsPerAxis;
+        ContactNeighbours.Skin    = slop;
+        ContactNeighbours.Rebuild(Circles, [&](std::span<const Circle> circles, auto&& pairCallback) {
+            ForEachCandidatePair(ContactBroadPhases, circles, containerRadius, pairCallback);
+        });
+        return ContactNeighbours.GetPairs();
+    }
+
+    // The held circle follows the mouse in steps shorter than its radius with the static shapes resolved after each, a
+    // step that short can't take its center past a shape, so it can be dragged along walls but not through them. When
+    // the mouse is too far away for MaxSteps it catches up over the next iterations.
+    void MoveSelectedCircle(Circle& circle, glm::vec2 target) {
+        constexpr std::size_t MaxSteps = 64;
+
+        if (Statics.IsEmpty() || !HasCollisions(circle)) {
+            circle.Position = target;
+            return;
+        }
+        float maxStep = circle.Radius * 0.5f;
+        for (std::size_t step = 0; step < MaxSteps && circle.Position != target; step++) {
+            glm::vec2 offset = target - circle.Position;
+            float distance   = glm::length(offset);
+            circle.Position  = distance > maxStep ? circle.Position + offset * (maxStep / distance) : target;
+            Statics.Query(GetBounds(circle), [&](std::uint32_t shape) {
+                ResolveStaticCollision(circle, Statics.GetShape(shape));
+            });
+        }
+    }
+
+    // Pairs between two sleeping circles have nothing to solve. With the neighbour list they are only filtered out again
+    // once it was rebuilt or circles fell asleep or woke up, and while no circle is asleep they aren't copied at all.
+    std::span<const CandidatePair> FindAwakePairs(float containerRadius) {
+        std::span<const CandidatePair> pairs = FindCollisionPairs(containerRadius);
+
+        bool sameRebuild = UseNeighbourList && AwakePairsVersion != 0 && AwakeRebuild == Neighbours.GetRebuildCount();
+        if (sameRebuild && AwakeSleepChanges == CircleIslands.GetSleepChangeCount())
+            return FilteredPairs;
+
+        AwakeRebuild      = Neighbours.GetRebuildCount();
+        AwakeSleepChanges = CircleIslands.GetSleepChangeCount();
+        if (++AwakePairsVersion == 0)
+            AwakePairsVersion = 1;
+        PushedSleepingCircles.clear();
+        if (CircleIslands.GetAsleepCount() == 0) {
+            FilteredPairs = pairs;
+            return FilteredPairs;
+        }
+
+        AwakePairs.clear();
+        for (const CandidatePair& pair : pairs) {
+            bool asleepA = IsAsleep(Circles[pair.A]);
+            bool asleepB = IsAsleep(Circles[pair.B]);
+            if (asleepA && asleepB)
+                continue;
+            AwakePairs.emplace_back(pair);
+            if (asleepA)
+                PushedSleepingCircles.emplace_back(pair.A);
+            if (asleepB)
+                PushedSleepingCircles.emplace_back(pair.B);
+        }
+        FilteredPairs = AwakePairs;
+        return FilteredPairs;
+    }
+
+    // The colours are solved one after another, so Gauss-Seidel stays Gauss-Seidel, just in a different order of pairs
+    void SolveCollisions(float containerRadius) {
+        constexpr std::size_t MinPairsPerThread = 256;
+
+        // The pairs only have to be coloured, batched or handed to the Jacobi solver again when they were filtered again
+        auto pairsChanged = [&](std::uint32_t& preparedVersion) {
+            bool changed    = preparedVersion != AwakePairsVersion;
+            preparedVersion = AwakePairsVersion;
+            return changed;
+        };
+
+        std::span<const CandidatePair> pairs = FindAwakePairs(containerRadius);
+        if (CollisionSolver == SolverMode::Jacobi) {
+            if (pairsChanged(JacobiVersion))
+                Jacobi.SetPairs(pairs, Circles.size());
+            Jacobi.Solve(Circles, Threads);
+            return;
+        }
+        if (!ParallelCollisions || Threads.GetThreadCount() == 1) {
+            // Without batches most SIMD lanes share a circle with an earlier lane and fall back to one pair at a time,
+            // but building the batches costs more than it saves on pairs that are only solved once. They are only built
+            // once the same pairs are solved again, which takes the neighbour list.
+            bool solvedBefore = SolvedVersion == AwakePairsVersion;
+            SolvedVersion     = AwakePairsVersion;
+            std::size_t width = Collisions.GetBatchWidth();
+            if (width == 1 || !solvedBefore) {
+                Collisions.Solve(Circles, pairs);
+                return;
+            }
+            if (pairsChanged(BatchedVersion) || PairBatches.GetWidth() != width)
+                PairBatches.Build(pairs, Circles.size(), width);
+            Collisions.SolveIndependent(Circles, PairBatches.GetBatched());
+            Collisions.Solve(Circles, PairBatches.GetLeftovers());
+            return;
+        }
+
+        if (pairsChanged(ColouredVersion))
+            PairColours.Build(pairs, Circles.size());
+        for (std::size_t colour = 0; colour < PairColours.GetColourCount(); colour++) {
+            std::span<const CandidatePair> colourPairs = PairColours.GetColour(colour);
+
+            // Small colours aren't worth waking the other threads for
+            std::size_t threadCount = std::min(colourPairs.size() / MinPairsPerThread + 1, Threads.GetThreadCount());
+            Threads.Run(threadCount, [&](std::size_t thread) {
+                auto [begin, end] = ThreadPool::GetChunk(colourPairs.size(), threadCount, thread);
+                Collisions.SolveIndependent(Circles, colourPairs.subspan(begin, end - begin));
+            });
+        }
+        Collisions.Solve(Circles, PairColours.GetUncoloured());
+    }
+
+    // Pairs of circles whose layers and masks rule out a collision are dropped here, before they reach the narrow phase
+    template <typename Callback>
+    void ForEachCandidatePair(BroadPhaseSet& broadPhases,
+                              std::span<const Circle> circles,
+                              float containerRadius,
+                              Callback&& pairCallback) {
+        auto callback = [&](std::uint32_t a, std::uint32_t b) {
+            if (CanCollide(circles[a], circles[b]))
+                pairCallback(a, b);
+        };
+        if (CollisionBroadPhase == BroadPhase::UniformGrid && HasContainer) {
+            if (IncrementalGrid) {
+                broadPhases.Grid.Update(circles, glm::vec2{ -containerRadius }, glm::vec2{ containerRadius }, Threads);
+            } else {
+                broadPhases.Grid.Build(circles, glm::vec2{ -containerRadius }, glm::vec2{ containerRadius }, Threads);
+            }
+            broadPhases.Grid.ForEachPair(callback);
+        } else if (CollisionBroadPhase == BroadPhase::AabbTree) {
+            broadPhases.Tree.Update(circles);
+            broadPhases.Tree.ForEachPair(callback);
+        } else if (CollisionBroadPhase == BroadPhase::HierarchicalGrid) {
+            broadPhases.MultiLevelGrid.Build(circles);
+            broadPhases.MultiLevelGrid.ForEachPair(callback);
+        } else if (CollisionBroadPhase == BroadPhase::LooseQuadtree) {
+            broadPhases.Quadtree.Update(circles);
+            broadPhases.Quadtree.ForEachPair(callback);
+        } else if (CollisionBroadPhase == BroadPhase::MultiBoxPruning) {
+            // The container is the whole world, without it the regions are set up through GetMultiBoxPruning
+            if (HasContainer)
+                broadPhases.MultiBox.Bounds = Aabb{ glm::vec2{ -containerRadius }, glm::vec2{ containerRadius } };
+            broadPhases.MultiBox.Update(circles, Threads);
+            broadPhases.MultiBox.ForEachPair(callback);
+        } else if (CollisionBroadPhase == BroadPhase::AllPairs) {
+            for (std::uint32_t a = 0; a < circles.size(); a++) {
+                if (!HasCollisions(circles[a]))
+                    continue;
+                for (std::uint32_t b = a + 1; b < circles.size(); b++) {
+                    if (HasCollisions(circles[b]))
+                        callback(a, b);
+                }
+            }
+        } else if (CollisionBroadPhase == BroadPhase::SweepAndPrune) {
+            broadPhases.Sweep.Update(circles, Threads);
+            broadPhases.Sweep.ForEachPair(callback);
+        } else {
+            broadPhases.Hash.Build(circles);
+            broadPhases.Hash.ForEachPair(callback);
+        }
+    }
+
+    std::uint32_t TakeCircleHole() {
+        while (!CircleHoles.empty()) {
+            std::uint32_t hole = CircleHoles.back();
+            CircleHoles.pop_back();
+            if (hole < Circles.size() && CircleHandles[hole].Generation == 0)
+                return hole;
+        }
+        return static_cast<std::uint32_t>(Circles.size());
+    }
+
     void RecalculateProjectionMatrix() {
         float aspect     = static_cast<float>(Width) / static_cast<float>(Height);
         ProjectionMatrix = glm::orthoLH(-aspect * CameraScale, aspect * CameraScale, -CameraScale, CameraScale, -1.0f, 1.0f);
@@ -258,6 +789,8 @@ private:
     static constexpr GLint ViewMatrixLocation         = 1;
     static constexpr GLint ModelMatrixLocation        = 2;
     static constexpr GLint ColorLocation              = 3;
+    static constexpr GLint SegmentLocation            = 2;
+    static constexpr GLint RadiusLocation             = 4;
     static constexpr const char* CircleVertexSource   = R"###(
 #version 440 core
 
@@ -292,6 +825,52 @@ void main() {
     }
     o_Color = u_Color;
 }
+)###";
+    // Draws a capsule around the segment from u_Segment.xy to u_Segment.zw, on a quad around it along the segment
+    static constexpr const char* StaticVertexSource   = R"###(
+#version 440 core
+
+layout(location = 0) uniform mat4 u_ProjectionMatrix;
+layout(location = 1) uniform mat4 u_ViewMatrix;
+layout(location = 2) uniform vec4 u_Segment;
+layout(location = 4) uniform float u_Radius;
+
+layout(location = 0) out vec2 v_Position;
+
+void main() {
+    vec2 segment = u_Segment.zw - u_Segment.xy;
+    vec2 direction = dot(segment, segment) > 0.0 ? normalize(segment) : vec2(1.0, 0.0);
+    vec2 normal = vec2(-direction.y, direction.x);
+    vec2 corner = vec2(
+        (gl_VertexID >> 0) & 1,
+        (gl_VertexID >> 1) & 1
+    ) * 2.0 - 1.0;
+    vec2 end = corner.x < 0.0 ? u_Segment.xy : u_Segment.zw;
+    v_Position = end + (direction * corner.x + normal * corner.y) * u_Radius;
+    gl_Position = u_ProjectionMatrix * u_ViewMatrix * vec4(v_Position, 0.0, 1.0);
+}
+)###";
+    static constexpr const char* StaticFragmentSource = R"###(
+#version 440 core
+
+layout(location = 0) out vec4 o_Color;
+
+layout(location = 0) in vec2 v_Position;
+
+layout(location = 2) uniform vec4 u_Segment;
+layout(location = 3) uniform vec4 u_Color;
+layout(location = 4) uniform float u_Radius;
+
+void main() {
+    vec2 segment = u_Segment.zw - u_Segment.xy;
+    float length2 = dot(segment, segment);
+    float t = length2 > 0.0 ? clamp(dot(v_Position - u_Segment.xy, segment) / length2, 0.0, 1.0) : 0.0;
+    vec2 offset = v_Position - (u_Segment.xy + segment * t);
+    if (dot(offset, offset) > u_Radius * u_Radius) {
+        discard;
+    }
+    o_Color = u_Color;
+}
 )###";
 };
 
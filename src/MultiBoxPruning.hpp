@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Aabb.hpp"
+#include "Circle.hpp"
+#include "RadixSort.hpp"
+#include "ThreadPool.hpp"
+
+// Broad phase that splits the world into a fixed grid of regions, each with its own sweep and prune over the fat boxes
+// of the circles overlapping it. The regions along the edges reach out to infinity, so circles outside Bounds still
+// land in a region. A region's pairs are kept between updates and it is only swept again once one of its circles
+// leaves its fat box, so regions where nothing happens cost nothing and the regions that did change are updated in
+// parallel. Meant for large worlds where the activity is localised, the region grid has to be set up for the world.
+class MultiBoxPruning {
+public:
+    Aabb Bounds{ glm::vec2{ -1.0f }, glm::vec2{ 1.0f } };
+    std::uint32_t RegionsPerAxis = 4;
+    // Margin of the fat boxes as a fraction of the circle's radius. A wider margin lets a circle move further before its
+    // regions have to be swept again, but the sweeps work on the fat boxes, so it also gives every sweep more pairs.
+    float FatMarginScale = 0.1f;
+
+    void Update(std::span<const Circle> circles, ThreadPool& threads) {
+        std::uint32_t regionsPerAxis = std::clamp<std::uint32_t>(RegionsPerAxis, 1, MaxRegionsPerAxis);
+        if (Bounds.Min != RegionBounds.Min || Bounds.Max != RegionBounds.Max || regionsPerAxis != RegionAxisCount)
+            Reset(regionsPerAxis);
+
+        // Circles past the end of the span are gone, they leave the regions they were in
+        bool anyDirty = false;
+        for (std::size_t i = circles.size(); i < CircleRegions.size(); i++) {
+            MarkRegions(CircleRegions[i], &Region::Dirty);
+            anyDirty = true;
+        }
+        CircleRegions.resize(circles.size());
+        FatBounds.resize(circles.size());
+
+        for (std::size_t i = 0; i < circles.size(); i++) {
+            const Circle& circle = circles[i];
+            RegionRange range{};
+            if (HasCollisions(circle)) {
+                Aabb bounds = GetBounds(circle);
+                if (!CircleRegions[i].IsEmpty() && FatBounds[i].Contains(bounds))
+                    continue;
+                float margin = circle.Radius * FatMarginScale;
+                FatBounds[i] = Aabb{ bounds.Min - margin, bounds.Max + margin };
+                range        = GetRegionRange(FatBounds[i]);
+            } else if (CircleRegions[i].IsEmpty()) {
+                continue;
+            }
+
+            // A circle that stays in the same regions only needs its entries moved, otherwise the regions it left and
+            // entered have to gather their circles again
+            if (range == CircleRegions[i]) {
+                MarkRegions(range, &Region::Moved);
+                continue;
+            }
+            MarkRegions(CircleRegions[i], &Region::Dirty);
+            MarkRegions(range, &Region::Dirty);
+            CircleRegions[i] = range;
+            anyDirty         = true;
+        }
+
+        if (anyDirty)
+            GatherDirtyRegions();
+
+        ChangedRegions.clear();
+        for (std::uint32_t region = 0; region < Regions.size(); region++) {
+            if (Regions[region].Dirty || Regions[region].Moved)
+                ChangedRegions.emplace_back(region);
+        }
+        if (ChangedRegions.empty())
+            return;
+        std::size_t threadCount = std::min(ChangedRegions.size(), threads.GetThreadCount());
+        if (ThreadSorts.size() < threadCount)
+            ThreadSorts.resize(threadCount);
+        threads.Run(threadCount, [&](std::size_t thread) {
+            auto [begin, end] = ThreadPool::GetChunk(ChangedRegions.size(), threadCount, thread);
+            for (std::size_t i = begin; i < end; i++) {
+                UpdateRegion(ChangedRegions[i], ThreadSorts[thread]);
+            }
+        });
+    }
+
+    // Calls callback(a, b) once for every pair of circles whose fat boxes overlap, with a < b
+    template <typename Callback>
+    void ForEachPair(Callback&& callback) const {
+        for (const Region& region : Regions) {
+            for (const CandidatePair& pair : region.Pairs) {
+                callback(pair.A, pair.B);
+            }
+        }
+    }
+private:
+    static constexpr std::uint32_t MaxRegionsPerAxis = 256; // Region coordinates are stored in 16 bits
+
+    // Inclusive range of region coordinates, empty for circles without collisions
+    struct RegionRange {
+        std::uint16_t MinX = 1;
+        std::uint16_t MinY = 1;
+        std::uint16_t MaxX = 0;
+        std::uint16_t MaxY = 0;
+
+        bool IsEmpty() const {
+            return MinX > MaxX;
+        }
+
+        bool operator==(const RegionRange&) const = default;
+    };
+
+    struct Entry {
+        float MinX;
+        float MaxX;
+        float MinY;
+        float MaxY;
+        std::uint32_t Circle;
+        std::uint16_t RegionX; // Region of the lower corner of the box
+        std::uint16_t RegionY;
+    };
+
+    struct Region {
+        std::vector<Entry> Entries; // Sorted by MinX
+        std::vector<CandidatePair> Pairs;
+        bool Dirty = false; // Circles entered or left the region
+        bool Moved = false; // Circles in the region got new fat boxes
+    };
+
+    Aabb RegionBounds{ glm::vec2{ 0.0f }, glm::vec2{ 0.0f } };
+    std::uint32_t RegionAxisCount = 0;
+    std::vector<Region> Regions;
+    std::vector<RegionRange> CircleRegions;
+    std::vector<Aabb> FatBounds;
+    std::vector<std::uint32_t> ChangedRegions;
+
+    // The regions are already updated in parallel, so every thread sorts its regions on its own with its own buffers
+    struct RegionSort {
+        RadixSorter<std::uint32_t> Sorter;
+        std::vector<std::uint32_t> Keys;
+        std::vector<std::uint32_t> Order;
+        std::vector<Entry> Entries;
+    };
+    std::vector<RegionSort> ThreadSorts;
+    ThreadPool SingleThread{ 1 };
+
+    void Reset(std::uint32_t regionsPerAxis) {
+        RegionBounds    = Bounds;
+        RegionAxisCount = regionsPerAxis;
+        Regions.assign(static_cast<std::size_t>(RegionAxisCount) * RegionAxisCount, Region{});
+        CircleRegions.clear();
+        FatBounds.clear();
+    }
+
+    std::uint16_t GetRegionCoordinate(float position, std::size_t axis) const {
+        float size  = (RegionBounds.Max[axis] - RegionBounds.Min[axis]) / static_cast<float>(RegionAxisCount);
+        float index = glm::floor((position - RegionBounds.Min[axis]) / size);
+        return static_cast<std::uint16_t>(glm::clamp(index, 0.0f, static_cast<float>(RegionAxisCount - 1)));
+    }
+
+    RegionRange GetRegionRange(const Aabb& box) const {
+        return RegionRange{
+            .MinX = GetRegionCoordinate(box.Min.x, 0),
+            .MinY = GetRegionCoordinate(box.Min.y, 1),
+            .MaxX = GetRegionCoordinate(box.Max.x, 0),
+            .MaxY = GetRegionCoordinate(box.Max.y, 1),
+        };
+    }
+
+    void MarkRegions(const RegionRange& range, bool Region::*flag) {
+        for (std::uint32_t y = range.MinY; y <= range.MaxY && !range.IsEmpty(); y++) {
+            for (std::uint32_t x = range.MinX; x <= range.MaxX; x++) {
+                Regions[y * RegionAxisCount + x].*flag = true;
+            }
+        }
+    }
+
+    // Refills the entries of the dirty regions from the circles' current ranges
+    void GatherDirtyRegions() {
+        for (Region& region : Regions) {
+            if (region.Dirty)
+                region.Entries.clear();
+        }
+        for (std::uint32_t i = 0; i < CircleRegions.size(); i++) {
+            const RegionRange& range = CircleRegions[i];
+            for (std::uint32_t y = range.MinY; y <= range.MaxY && !range.IsEmpty(); y++) {
+                for (std::uint32_t x = range.MinX; x <= range.MaxX; x++) {
+                    Region& region = Regions[y * RegionAxisCount + x];
+                    if (region.Dirty)
+                        region.Entries.emplace_back(GetEntry(i));
+                }
+            }
+        }
+    }
+
+    Entry GetEntry(std::uint32_t circle) const {
+        const Aabb& box          = FatBounds[circle];
+        const RegionRange& range = CircleRegions[circle];
+        return Entry{ box.Min.x, box.Max.x, box.Min.y, box.Max.y, circle, range.MinX, range.MinY };
+    }
+
+    // Sorts and sweeps a region, a pair that overlaps several regions is only kept by the region holding the lower
+    // corner of the overlap of its boxes, which is the larger of the regions holding the lower corners of the boxes
+    void UpdateRegion(std::uint32_t regionIndex, RegionSort& sort) {
+        Region& region = Regions[regionIndex];
+
+        auto byMinX = [](const Entry& a, const Entry& b) {
+            return a.MinX < b.MinX;
+        };
+        if (region.Dirty) {
+            std::size_t count = region.Entries.size();
+            sort.Keys.resize(count);
+            sort.Order.resize(count);
+            for (std::size_t i = 0; i < count; i++) {
+                sort.Keys[i]  = GetSortableKey(region.Entries[i].MinX);
+                sort.Order[i] = static_cast<std::uint32_t>(i);
+            }
+            sort.Sorter.Sort(sort.Keys, sort.Order, SingleThread);
+
+            sort.Entries.resize(count);
+            for (std::size_t i = 0; i < count; i++) {
+                sort.Entries[i] = region.Entries[sort.Order[i]];
+            }
+            std::swap(region.Entries, sort.Entries);
+        } else {
+            // The entries were only moved a little, so an insertion sort puts them back in order
+            for (Entry& entry : region.Entries) {
+                entry = GetEntry(entry.Circle);
+            }
+            for (std::size_t i = 1; i < region.Entries.size(); i++) {
+                Entry entry   = region.Entries[i];
+                std::size_t j = i;
+                for (; j > 0 && byMinX(entry, region.Entries[j - 1]); j--) {
+                    region.Entries[j] = region.Entries[j - 1];
+                }
+                region.Entries[j] = entry;
+            }
+        }
+        region.Dirty = false;
+        region.Moved = false;
+
+        std::uint16_t regionX = static_cast<std::uint16_t>(regionIndex % RegionAxisCount);
+        std::uint16_t regionY = static_cast<std::uint16_t>(regionIndex / RegionAxisCount);
+        region.Pairs.clear();
+        for (std::size_t i = 0; i < region.Entries.size(); i++) {
+            const Entry& a = region.Entries[i];
+            for (std::size_t j = i + 1; j < region.Entries.size() && region.Entries[j].MinX <= a.MaxX; j++) {
+                const Entry& b = region.Entries[j];
+                if (a.MinY > b.MaxY || b.MinY > a.MaxY)
+                    continue;
+                if (std::max(a.RegionX, b.RegionX) != regionX || std::max(a.RegionY, b.RegionY) != regionY)
+                    continue;
+                region.Pairs.emplace_back(CandidatePair{ std::min(a.Circle, b.Circle), std::max(a.Circle, b.Circle) });
+            }
+        }
+    }
+};
@@ -0,0 +1,377 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Circle.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define VERLET_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+    #endif
+#else
+    #define VERLET_X86 0
+#endif
+
+// GCC and Clang only allow intrinsics in functions compiled for their instruction set, MSVC allows them anywhere
+#if VERLET_X86 && (defined(__GNUC__) || defined(__clang__))
+    #define VERLET_TARGET(isa) __attribute__((target(isa)))
+#else
+    #define VERLET_TARGET(isa)
+#endif
+
+enum struct SimdLevel {
+    Scalar,
+    Sse41,
+    Avx2,
+    Avx512,
+};
+
+// The widest instruction set that both the CPU and the OS support, detected once
+inline SimdLevel GetSupportedSimdLevel() {
+#if VERLET_X86
+    static const SimdLevel level = []() {
+    #if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+        __cpuid(info, 1);
+        bool sse41   = (info[2] & (1 << 19)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx     = (info[2] & (1 << 28)) != 0;
+        if (!sse41)
+            return SimdLevel::Scalar;
+        // The OS has to save the AVX registers (and the AVX-512 ones) on context switches
+        std::uint64_t enabledState = osxsave ? _xgetbv(0) : 0;
+        if (!avx || maxLeaf < 7 || (enabledState & 0x6) != 0x6)
+            return SimdLevel::Sse41;
+        __cpuidex(info, 7, 0);
+        bool avx2    = (info[1] & (1 << 5)) != 0;
+        bool avx512f = (info[1] & (1 << 16)) != 0;
+        if (avx512f && (enabledState & 0xE6) == 0xE6)
+            return SimdLevel::Avx512;
+        return avx2 ? SimdLevel::Avx2 : SimdLevel::Sse41;
+    #else
+        // These read CPUID and check that the OS saves the extended registers
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return SimdLevel::Avx512;
+        if (__builtin_cpu_supports("avx2"))
+            return SimdLevel::Avx2;
+        if (__builtin_cpu_supports("sse4.1"))
+            return SimdLevel::Sse41;
+        return SimdLevel::Scalar;
+    #endif
+    }();
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+// Resolves the candidate pairs in order, like calling ResolveCollision on each of them, but tests and resolves 4, 8 or
+// 16 pairs at once with the widest instruction set the CPU has. Lanes are written back in order until one shares a
+// circle with an earlier lane that collided, from there on the batch is resolved one pair at a time, so every pair sees
+// the positions it would have seen in the scalar loop. Whether two circles collide is decided with the same squared
+// distance test in every path, only the pushes differ in their last bits because the normal comes from a reciprocal
+// square root. Pairs straight from a broad phase share circles so often that most batches end up being resolved one
+// pair at a time, PairBatching reorders them into batches that don't.
+class NarrowPhase {
+public:
+    // The kernels are slower than the scalar loop on pairs straight from a broad phase and only pay off on batched pairs
+    // that are solved many times, so they are opt in, with GetSupportedSimdLevel() for the widest one the CPU has
+    SimdLevel Level = SimdLevel::Scalar;
+
+    void Solve(std::span<Circle> circles, std::span<const CandidatePair> pairs) {
+        if (WrittenStamps.size() < circles.size())
+            WrittenStamps.resize(circles.size(), Stamp);
+        SolveBatches(circles, pairs, false);
+    }
+
+    // For pairs that share no circles, like the colours of a PairColouring, or for batches of GetBatchWidth pairs that
+    // share no circles within a batch, like the ones from a PairBatching. Every lane is written back without the checks
+    // for shared circles, and different threads can solve different pairs at the same time.
+    void SolveIndependent(std::span<Circle> circles, std::span<const CandidatePair> pairs) {
+        SolveBatches(circles, pairs, true);
+    }
+
+    // Number of pairs the kernel for Level resolves at once
+    std::size_t GetBatchWidth() const {
+#if VERLET_X86
+        if (Level == SimdLevel::Avx512)
+            return 16;
+        if (Level == SimdLevel::Avx2)
+            return 8;
+        if (Level == SimdLevel::Sse41)
+            return 4;
+#endif
+        return 1;
+    }
+private:
+    static constexpr std::size_t MaxWidth = 16;
+
+    // Pushes for each lane of a batch, only valid for the lanes in HitMask
+    struct BatchResult {
+        alignas(64) float AX[MaxWidth];
+        alignas(64) float AY[MaxWidth];
+        alignas(64) float BX[MaxWidth];
+        alignas(64) float BY[MaxWidth];
+        std::uint32_t HitMask;
+    };
+
+    std::uint32_t Stamp = 0;
+    std::vector<std::uint32_t> WrittenStamps; // Circles moved by the current batch have the current stamp
+
+    void SolveBatches(std::span<Circle> circles, std::span<const CandidatePair> pairs, bool independent) {
+        std::size_t solved = 0;
+#if VERLET_X86
+        if (Level == SimdLevel::Avx512) {
+            solved = SolveAvx512(circles, pairs, independent);
+        } else if (Level == SimdLevel::Avx2) {
+            solved = SolveAvx2(circles, pairs, independent);
+        } else if (Level == SimdLevel::Sse41) {
+            solved = SolveSse41(circles, pairs, independent);
+        }
+#endif
+        for (std::size_t i = solved; i < pairs.size(); i++) {
+            ResolveCollision(circles[pairs[i].A], circles[pairs[i].B]);
+        }
+    }
+
+    void FinishBatch(std::span<Circle> circles,
+                     const CandidatePair* pairs,
+                     std::size_t width,
+                     const BatchResult& result,
+                     bool independent) {
+        if (independent) {
+            for (std::size_t lane = 0; lane < width; lane++) {
+                if ((result.HitMask & (1u << lane)) == 0)
+                    continue;
+                circles[pairs[lane].A].Position += glm::vec2{ result.AX[lane], result.AY[lane] };
+                circles[pairs[lane].B].Position += glm::vec2{ result.BX[lane], result.BY[lane] };
+            }
+            return;
+        }
+
+        if (++Stamp == 0) {
+            std::fill(WrittenStamps.begin(), WrittenStamps.end(), 0);
+            Stamp = 1;
+        }
+        for (std::size_t lane = 0; lane < width; lane++) {
+            std::uint32_t a = pairs[lane].A;
+            std::uint32_t b = pairs[lane].B;
+            if (WrittenStamps[a] == Stamp || WrittenStamps[b] == Stamp) {
+                for (; lane < width; lane++) {
+                    ResolveCollision(circles[pairs[lane].A], circles[pairs[lane].B]);
+                }
+                return;
+            }
+            if ((result.HitMask & (1u << lane)) == 0)
+                continue;
+            circles[a].Position += glm::vec2{ result.AX[lane], result.AY[lane] };
+            circles[b].Position += glm::vec2{ result.BX[lane], result.BY[lane] };
+            WrittenStamps[a] = Stamp;
+            WrittenStamps[b] = Stamp;
+        }
+    }
+
+#if VERLET_X86
+    // The AVX2 and AVX-512 kernels gather the fields straight out of the circle array
+    static constexpr int CircleStride      = sizeof(Circle) / sizeof(float);
+    static constexpr int PositionXOffset   = offsetof(Circle, Position) / sizeof(float);
+    static constexpr int RadiusOffset      = offsetof(Circle, Radius) / sizeof(float);
+    static constexpr int InverseMassOffset = offsetof(Circle, InverseMass) / sizeof(float);
+    static_assert(sizeof(Circle) % sizeof(float) == 0 && sizeof(glm::vec2) == 2 * sizeof(float));
+
+    VERLET_TARGET("sse4.1")
+    std::size_t SolveSse41(std::span<Circle> circles, std::span<const CandidatePair> pairs, bool independent) {
+        constexpr std::size_t Width = 4;
+
+        BatchResult result;
+        std::size_t count = pairs.size() - pairs.size() % Width;
+        for (std::size_t first = 0; first < count; first += Width) {
+            const CandidatePair* batch = &pairs[first];
+            const Circle& a0           = circles[batch[0].A];
+            const Circle& a1           = circles[batch[1].A];
+            const Circle& a2           = circles[batch[2].A];
+            const Circle& a3           = circles[batch[3].A];
+            const Circle& b0           = circles[batch[0].B];
+            const Circle& b1           = circles[batch[1].B];
+            const Circle& b2           = circles[batch[2].B];
+            const Circle& b3           = circles[batch[3].B];
+
+            __m128 dx              = _mm_sub_ps(_mm_setr_ps(b0.Position.x, b1.Position.x, b2.Position.x, b3.Position.x),
+                                                _mm_setr_ps(a0.Position.x, a1.Position.x, a2.Position.x, a3.Position.x));
+            __m128 dy              = _mm_sub_ps(_mm_setr_ps(b0.Position.y, b1.Position.y, b2.Position.y, b3.Position.y),
+                                                _mm_setr_ps(a0.Position.y, a1.Position.y, a2.Position.y, a3.Position.y));
+            __m128 distance2       = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+            __m128 minimumDistance = _mm_add_ps(_mm_setr_ps(a0.Radius, a1.Radius, a2.Radius, a3.Radius),
+                                                _mm_setr_ps(b0.Radius, b1.Radius, b2.Radius, b3.Radius));
+            __m128 hit             = _mm_cmplt_ps(distance2, _mm_mul_ps(minimumDistance, minimumDistance));
+            result.HitMask         = static_cast<std::uint32_t>(_mm_movemask_ps(hit));
+            if (result.HitMask == 0)
+                continue;
+
+            // One Newton step takes the estimate from 12 to about 23 bits
+            __m128 inverseDistance = _mm_rsqrt_ps(distance2);
+            __m128 halfDistance2   = _mm_mul_ps(distance2, _mm_set1_ps(0.5f));
+            __m128 error           = _mm_mul_ps(halfDistance2, _mm_mul_ps(inverseDistance, inverseDistance));
+            inverseDistance        = _mm_mul_ps(inverseDistance, _mm_sub_ps(_mm_set1_ps(1.5f), error));
+            __m128 depth           = _mm_sub_ps(minimumDistance, _mm_mul_ps(distance2, inverseDistance));
+            __m128 normalX         = _mm_mul_ps(dx, inverseDistance);
+            __m128 normalY         = _mm_mul_ps(dy, inverseDistance);
+
+            // The lighter circle takes most of the correction, see ResolveCollision
+            __m128 inverseMassA       = _mm_setr_ps(a0.InverseMass, a1.InverseMass, a2.InverseMass, a3.InverseMass);
+            __m128 inverseMassB       = _mm_setr_ps(b0.InverseMass, b1.InverseMass, b2.InverseMass, b3.InverseMass);
+            __m128 minimumInverseMass = _mm_min_ps(inverseMassA, inverseMassB);
+            __m128 maximumInverseMass = _mm_max_ps(inverseMassA, inverseMassB);
+            __m128 ratio              = _mm_div_ps(minimumInverseMass, maximumInverseMass);
+            __m128 halfRatio          = _mm_mul_ps(ratio, _mm_set1_ps(0.5f));
+            __m128 aIsHeavier         = _mm_cmple_ps(inverseMassA, inverseMassB);
+            __m128 otherShare         = _mm_sub_ps(_mm_set1_ps(1.0f), halfRatio);
+            __m128 pushA              = _mm_mul_ps(depth, _mm_blendv_ps(otherShare, halfRatio, aIsHeavier));
+            __m128 pushB              = _mm_mul_ps(depth, _mm_blendv_ps(halfRatio, otherShare, aIsHeavier));
+
+            _mm_store_ps(result.AX, _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(normalX, pushA)));
+            _mm_store_ps(result.AY, _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(normalY, pushA)));
+            _mm_store_ps(result.BX, _mm_mul_ps(normalX, pushB));
+            _mm_store_ps(result.BY, _mm_mul_ps(normalY, pushB));
+            FinishBatch(circles, batch, Width, result, independent);
+        }
+        return count;
+    }
+
+    VERLET_TARGET("avx2")
+    std::size_t SolveAvx2(std::span<Circle> circles, std::span<const CandidatePair> pairs, bool independent) {
+        constexpr std::size_t Width = 8;
+
+        const float* base = reinterpret_cast<const float*>(circles.data());
+        BatchResult result;
+        std::size_t count = pairs.size() - pairs.size() % Width;
+        for (std::size_t first = 0; first < count; first += Width) {
+            const CandidatePair* batch = &pairs[first];
+            // Both indices of every pair, deinterleaved into the circles' offsets in floats
+            __m256i pairsLow  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(batch));
+            __m256i pairsHigh = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(batch + Width / 2));
+            __m256i order     = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+            __m256i low       = _mm256_permutevar8x32_epi32(pairsLow, order);
+            __m256i high      = _mm256_permutevar8x32_epi32(pairsHigh, order);
+            __m256i indexA    = _mm256_mullo_epi32(_mm256_permute2x128_si256(low, high, 0x20), _mm256_set1_epi32(CircleStride));
+            __m256i indexB    = _mm256_mullo_epi32(_mm256_permute2x128_si256(low, high, 0x31), _mm256_set1_epi32(CircleStride));
+
+            __m256 dx              = _mm256_sub_ps(_mm256_i32gather_ps(base + PositionXOffset, indexB, 4),
+                                                   _mm256_i32gather_ps(base + PositionXOffset, indexA, 4));
+            __m256 dy              = _mm256_sub_ps(_mm256_i32gather_ps(base + PositionXOffset + 1, indexB, 4),
+                                                   _mm256_i32gather_ps(base + PositionXOffset + 1, indexA, 4));
+            __m256 distance2       = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            __m256 minimumDistance = _mm256_add_ps(_mm256_i32gather_ps(base + RadiusOffset, indexA, 4),
+                                                   _mm256_i32gather_ps(base + RadiusOffset, indexB, 4));
+            __m256 hit             = _mm256_cmp_ps(distance2, _mm256_mul_ps(minimumDistance, minimumDistance), _CMP_LT_OQ);
+            result.HitMask         = static_cast<std::uint32_t>(_mm256_movemask_ps(hit));
+            if (result.HitMask == 0)
+                continue;
+
+            // One Newton step takes the estimate from 12 to about 23 bits
+            __m256 inverseDistance = _mm256_rsqrt_ps(distance2);
+            __m256 halfDistance2   = _mm256_mul_ps(distance2, _mm256_set1_ps(0.5f));
+            __m256 error           = _mm256_mul_ps(halfDistance2, _mm256_mul_ps(inverseDistance, inverseDistance));
+            inverseDistance        = _mm256_mul_ps(inverseDistance, _mm256_sub_ps(_mm256_set1_ps(1.5f), error));
+            __m256 depth           = _mm256_sub_ps(minimumDistance, _mm256_mul_ps(distance2, inverseDistance));
+            __m256 normalX         = _mm256_mul_ps(dx, inverseDistance);
+            __m256 normalY         = _mm256_mul_ps(dy, inverseDistance);
+
+            // The lighter circle takes most of the correction, see ResolveCollision
+            __m256 inverseMassA       = _mm256_i32gather_ps(base + InverseMassOffset, indexA, 4);
+            __m256 inverseMassB       = _mm256_i32gather_ps(base + InverseMassOffset, indexB, 4);
+            __m256 minimumInverseMass = _mm256_min_ps(inverseMassA, inverseMassB);
+            __m256 maximumInverseMass = _mm256_max_ps(inverseMassA, inverseMassB);
+            __m256 ratio              = _mm256_div_ps(minimumInverseMass, maximumInverseMass);
+            __m256 halfRatio          = _mm256_mul_ps(ratio, _mm256_set1_ps(0.5f));
+            __m256 aIsHeavier         = _mm256_cmp_ps(inverseMassA, inverseMassB, _CMP_LE_OQ);
+            __m256 otherShare         = _mm256_sub_ps(_mm256_set1_ps(1.0f), halfRatio);
+            __m256 pushA              = _mm256_mul_ps(depth, _mm256_blendv_ps(otherShare, halfRatio, aIsHeavier));
+            __m256 pushB              = _mm256_mul_ps(depth, _mm256_blendv_ps(halfRatio, otherShare, aIsHeavier));
+
+            _mm256_store_ps(result.AX, _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(normalX, pushA)));
+            _mm256_store_ps(result.AY, _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(normalY, pushA)));
+            _mm256_store_ps(result.BX, _mm256_mul_ps(normalX, pushB));
+            _mm256_store_ps(result.BY, _mm256_mul_ps(normalY, pushB));
+            FinishBatch(circles, batch, Width, result, independent);
+        }
+        return count;
+    }
+
+    VERLET_TARGET("avx512f")
+    std::size_t SolveAvx512(std::span<Circle> circles, std::span<const CandidatePair> pairs, bool independent) {
+        constexpr std::size_t Width = 16;
+        constexpr int Rounding      = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+
+        const float* base = reinterpret_cast<const float*>(circles.data());
+        BatchResult result;
+        std::size_t count = pairs.size() - pairs.size() % Width;
+        for (std::size_t first = 0; first < count; first += Width) {
+            const CandidatePair* batch = &pairs[first];
+            // Both indices of every pair, deinterleaved into the circles' offsets in floats
+            __m512i pairsLow  = _mm512_loadu_si512(batch);
+            __m512i pairsHigh = _mm512_loadu_si512(batch + Width / 2);
+            __m512i evens     = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+            __m512i odds      = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+            __m512i stride    = _mm512_set1_epi32(CircleStride);
+            __m512i indexA    = _mm512_mullo_epi32(_mm512_permutex2var_epi32(pairsLow, evens, pairsHigh), stride);
+            __m512i indexB    = _mm512_mullo_epi32(_mm512_permutex2var_epi32(pairsLow, odds, pairsHigh), stride);
+
+            // Explicitly rounded operations can't be fused into FMAs by the compiler, which would change the
+            // squared distances and with them which pairs collide compared to the other paths
+            __m512 ax               = _mm512_i32gather_ps(indexA, base + PositionXOffset, 4);
+            __m512 ay               = _mm512_i32gather_ps(indexA, base + PositionXOffset + 1, 4);
+            __m512 bx               = _mm512_i32gather_ps(indexB, base + PositionXOffset, 4);
+            __m512 by               = _mm512_i32gather_ps(indexB, base + PositionXOffset + 1, 4);
+            __m512 dx               = _mm512_sub_round_ps(bx, ax, Rounding);
+            __m512 dy               = _mm512_sub_round_ps(by, ay, Rounding);
+            __m512 dx2              = _mm512_mul_round_ps(dx, dx, Rounding);
+            __m512 distance2        = _mm512_add_round_ps(dx2, _mm512_mul_round_ps(dy, dy, Rounding), Rounding);
+            __m512 minimumDistance  = _mm512_add_round_ps(_mm512_i32gather_ps(indexA, base + RadiusOffset, 4),
+                                                          _mm512_i32gather_ps(indexB, base + RadiusOffset, 4),
+                                                          Rounding);
+            __m512 minimumDistance2 = _mm512_mul_round_ps(minimumDistance, minimumDistance, Rounding);
+            result.HitMask          = _mm512_cmp_ps_mask(distance2, minimumDistance2, _CMP_LT_OQ);
+            if (result.HitMask == 0)
+                continue;
+
+            // One Newton step takes the estimate from 14 to about 23 bits
+            __m512 inverseDistance = _mm512_rsqrt14_ps(distance2);
+            __m512 halfDistance2   = _mm512_mul_ps(distance2, _mm512_set1_ps(0.5f));
+            __m512 error           = _mm512_mul_ps(halfDistance2, _mm512_mul_ps(inverseDistance, inverseDistance));
+            inverseDistance        = _mm512_mul_ps(inverseDistance, _mm512_sub_ps(_mm512_set1_ps(1.5f), error));
+            __m512 depth           = _mm512_sub_ps(minimumDistance, _mm512_mul_ps(distance2, inverseDistance));
+            __m512 normalX         = _mm512_mul_ps(dx, inverseDistance);
+            __m512 normalY         = _mm512_mul_ps(dy, inverseDistance);
+
+            // The lighter circle takes most of the correction, see ResolveCollision
+            __m512 inverseMassA       = _mm512_i32gather_ps(indexA, base + InverseMassOffset, 4);
+            __m512 inverseMassB       = _mm512_i32gather_ps(indexB, base + InverseMassOffset, 4);
+            __m512 minimumInverseMass = _mm512_min_ps(inverseMassA, inverseMassB);
+            __m512 maximumInverseMass = _mm512_max_ps(inverseMassA, inverseMassB);
+            __m512 ratio              = _mm512_div_ps(minimumInverseMass, maximumInverseMass);
+            __m512 halfRatio          = _mm512_mul_ps(ratio, _mm512_set1_ps(0.5f));
+            __mmask16 aIsHeavier      = _mm512_cmp_ps_mask(inverseMassA, inverseMassB, _CMP_LE_OQ);
+            __m512 otherShare         = _mm512_sub_ps(_mm512_set1_ps(1.0f), halfRatio);
+            __m512 pushA              = _mm512_mul_ps(depth, _mm512_mask_blend_ps(aIsHeavier, otherShare, halfRatio));
+            __m512 pushB              = _mm512_mul_ps(depth, _mm512_mask_blend_ps(aIsHeavier, halfRatio, otherShare));
+
+            _mm512_store_ps(result.AX, _mm512_sub_ps(_mm512_setzero_ps(), _mm512_mul_ps(normalX, pushA)));
+            _mm512_store_ps(result.AY, _mm512_sub_ps(_mm512_setzero_ps(), _mm512_mul_ps(normalY, pushA)));
+            _mm512_store_ps(result.BX, _mm512_mul_ps(normalX, pushB));
+            _mm512_store_ps(result.BY, _mm512_mul_ps(normalY, pushB));
+            FinishBatch(circles, batch, Width, result, independent);
+        }
+        return count;
+    }
+#endif
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Circle.hpp"
+
+// Verlet neighbour list, the candidate pairs of circles that are within a skin distance of touching. As long as no
+// circle has moved more than half the skin since the list was built, no pair outside of it can be touching, so the
+// same list can be reused by every constraint iteration and over several steps.
+class NeighbourList {
+public:
+    float Skin = 0.02f;
+
+    // Forces a rebuild, needed whenever circles are added, removed, moved to another index or change collision layers
+    void Invalidate() {
+        Valid = false;
+    }
+
+    bool NeedsRebuild(std::span<const Circle> circles) const {
+        return !Covers(circles, 0.0f);
+    }
+
+    // Whether the pairs still hold every pair of circles closer than distance, which they do as long as no circle has
+    // moved more than half of what is left of the skin
+    bool Covers(std::span<const Circle> circles, float distance) const {
+        if (!Valid || circles.size() != BuildPositions.size() || distance > Skin)
+            return false;
+        float maxDistance  = (Skin - distance) * 0.5f;
+        float maxDistance2 = maxDistance * maxDistance;
+        for (std::size_t i = 0; i < circles.size(); i++) {
+            if (!HasCollisions(circles[i]))
+                continue;
+            glm::vec2 offset = circles[i].Position - BuildPositions[i];
+            if (glm::dot(offset, offset) > maxDistance2)
+                return false;
+        }
+        return true;
+    }
+
+    // Runs the broad phase on the circles grown by half the skin, findPairs(circles, callback(a, b)) must report
+    // every pair of them with overlapping bounds
+    template <typename FindPairs>
+    void Rebuild(std::span<const Circle> circles, FindPairs&& findPairs) {
+        SkinnedCircles.assign(circles.begin(), circles.end());
+        BuildPositions.resize(circles.size());
+        for (std::size_t i = 0; i < circles.size(); i++) {
+            SkinnedCircles[i].Radius += Skin * 0.5f;
+            BuildPositions[i] = circles[i].Position;
+        }
+
+        Pairs.clear();
+        findPairs(std::span<const Circle>{ SkinnedCircles }, [&](std::uint32_t a, std::uint32_t b) {
+            glm::vec2 offset = SkinnedCircles[a].Position - SkinnedCircles[b].Position;
+            float distance   = SkinnedCircles[a].Radius + SkinnedCircles[b].Radius;
+            if (glm::dot(offset, offset) <= distance * distance)
+                Pairs.emplace_back(CandidatePair{ a, b });
+        });
+        Valid = true;
+        RebuildCount++;
+    }
+
+    std::span<const CandidatePair> GetPairs() const {
+        return Pairs;
+    }
+
+    // Changes whenever the pairs do
+    std::uint32_t GetRebuildCount() const {
+        return RebuildCount;
+    }
+private:
+    bool Valid                 = false;
+    std::uint32_t RebuildCount = 0;
+    std::vector<CandidatePair> Pairs;
+    std::vector<glm::vec2> BuildPositions;
+    std::vector<Circle> SkinnedCircles;
+};
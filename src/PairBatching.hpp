@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Circle.hpp"
+
+// Reorders pairs of circles into batches of Width pairs in which no circle appears twice, so a SIMD kernel can gather,
+// solve and scatter a whole batch without two lanes writing the same circle. Unlike PairColouring this is about the
+// lanes within one thread, the batches are still solved one after another, so it stays Gauss-Seidel with the pairs in a
+// different order.
+class PairBatching {
+public:
+    static constexpr std::size_t MaxWidth       = 16;
+    static constexpr std::size_t MaxOpenBatches = 64;
+
+    // Greedily puts every pair in the first open batch that has neither of its circles, a batch is written out as soon
+    // as it is full. Pairs that fit in none of the MaxOpenBatches open batches, and the batches that never fill up, end
+    // up in the leftovers.
+    void Build(std::span<const CandidatePair> pairs, std::size_t circleCount, std::size_t width) {
+        Width = std::clamp<std::size_t>(width, 1, MaxWidth);
+        CircleBatches.assign(circleCount, 0);
+        BatchPairs.resize(MaxOpenBatches * Width);
+        BatchSizes.fill(0);
+        Pairs.clear();
+        Leftovers.clear();
+
+        for (const CandidatePair& pair : pairs) {
+            std::uint64_t used = CircleBatches[pair.A] | CircleBatches[pair.B];
+            if (used == ~std::uint64_t{ 0 }) {
+                Leftovers.emplace_back(pair);
+                continue;
+            }
+            std::size_t batch         = static_cast<std::size_t>(std::countr_one(used));
+            std::uint64_t batchBit    = std::uint64_t{ 1 } << batch;
+            CandidatePair* batchPairs = &BatchPairs[batch * Width];
+
+            batchPairs[BatchSizes[batch]++] = pair;
+            CircleBatches[pair.A] |= batchBit;
+            CircleBatches[pair.B] |= batchBit;
+            if (BatchSizes[batch] < Width)
+                continue;
+
+            for (std::size_t i = 0; i < Width; i++) {
+                CircleBatches[batchPairs[i].A] &= ~batchBit;
+                CircleBatches[batchPairs[i].B] &= ~batchBit;
+            }
+            Pairs.insert(Pairs.end(), batchPairs, batchPairs + Width);
+            BatchSizes[batch] = 0;
+        }
+
+        for (std::size_t batch = 0; batch < MaxOpenBatches; batch++) {
+            Leftovers.insert(Leftovers.end(), &BatchPairs[batch * Width], &BatchPairs[batch * Width] + BatchSizes[batch]);
+        }
+        BatchedCount = Pairs.size();
+        Pairs.insert(Pairs.end(), Leftovers.begin(), Leftovers.end());
+    }
+
+    std::size_t GetWidth() const {
+        return Width;
+    }
+
+    // Full batches back to back, a multiple of the width
+    std::span<const CandidatePair> GetBatched() const {
+        std::span<const CandidatePair> pairs = Pairs;
+        return pairs.first(BatchedCount);
+    }
+
+    // Pairs that may share circles with each other and have to be solved one at a time
+    std::span<const CandidatePair> GetLeftovers() const {
+        std::span<const CandidatePair> pairs = Pairs;
+        return pairs.subspan(BatchedCount);
+    }
+private:
+    std::size_t Width        = 0;
+    std::size_t BatchedCount = 0;
+    std::vector<CandidatePair> Pairs;         // The full batches, then the leftovers
+    std::vector<std::uint64_t> CircleBatches; // Bit set of the open batches each circle is in
+    std::vector<CandidatePair> BatchPairs;    // Width pairs for each open batch
+    std::array<std::size_t, MaxOpenBatches> BatchSizes;
+    std::vector<CandidatePair> Leftovers;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Circle.hpp"
+
+// Splits pairs of circles into colours in which no two pairs share a circle, so the pairs of one colour can be solved
+// at the same time. Solving the colours one after another is still Gauss-Seidel, every pair sees the positions written
+// by the colours before it, only the order of the pairs changes. Pairs keep their relative order within a colour.
+class PairColouring {
+public:
+    static constexpr std::size_t MaxColours = 64;
+
+    // Greedily gives every pair the lowest colour that neither of its circles has yet. Pairs whose circles already
+    // have all MaxColours colours between them are left uncoloured and have to be solved one at a time.
+    void Build(std::span<const CandidatePair> pairs, std::size_t circleCount) {
+        CircleColours.assign(circleCount, 0);
+        PairColours.resize(pairs.size());
+        ColourStarts.assign(MaxColours + 2, 0);
+        for (std::size_t i = 0; i < pairs.size(); i++) {
+            std::uint64_t used  = CircleColours[pairs[i].A] | CircleColours[pairs[i].B];
+            std::uint8_t colour = static_cast<std::uint8_t>(std::countr_one(used));
+            if (colour < MaxColours) {
+                CircleColours[pairs[i].A] |= std::uint64_t{ 1 } << colour;
+                CircleColours[pairs[i].B] |= std::uint64_t{ 1 } << colour;
+            }
+            PairColours[i] = colour;
+            ColourStarts[colour + 1]++;
+        }
+
+        // Counting sort of the pairs by colour, the uncoloured ones go last
+        for (std::size_t colour = 0; colour <= MaxColours; colour++) {
+            ColourStarts[colour + 1] += ColourStarts[colour];
+        }
+        Pairs.resize(pairs.size());
+        WritePositions.assign(ColourStarts.begin(), ColourStarts.end() - 1);
+        for (std::size_t i = 0; i < pairs.size(); i++) {
+            Pairs[WritePositions[PairColours[i]]++] = pairs[i];
+        }
+
+        ColourCount = 0;
+        for (std::size_t colour = 0; colour < MaxColours; colour++) {
+            if (ColourStarts[colour + 1] != ColourStarts[colour])
+                ColourCount = colour + 1;
+        }
+    }
+
+    std::size_t GetColourCount() const {
+        return ColourCount;
+    }
+
+    std::span<const CandidatePair> GetColour(std::size_t colour) const {
+        std::span<const CandidatePair> pairs = Pairs;
+        return pairs.subspan(ColourStarts[colour], ColourStarts[colour + 1] - ColourStarts[colour]);
+    }
+
+    std::span<const CandidatePair> GetUncoloured() const {
+        std::span<const CandidatePair> pairs = Pairs;
+        return pairs.subspan(ColourStarts[MaxColours]);
+    }
+private:
+    std::size_t ColourCount = 0;
+    std::vector<CandidatePair> Pairs;
+    std::vector<std::uint32_t> ColourStarts;  // Index of the first pair of each colour in Pairs, then the uncoloured ones
+    std::vector<std::uint64_t> CircleColours; // Bit set of the colours each circle has a pair in
+    std::vector<std::uint8_t> PairColours;
+    std::vector<std::uint32_t> WritePositions;
+};
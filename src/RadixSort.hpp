@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+// Maps a float to an unsigned key with the same order, negative floats have their bits flipped so that more negative
+// values come first, positive floats only get their sign bit set so that they come after all the negative ones
+inline std::uint32_t GetSortableKey(float value) {
+    std::uint32_t bits = std::bit_cast<std::uint32_t>(value);
+    return bits ^ ((bits >> 31) != 0 ? 0xFFFFFFFFu : 0x80000000u);
+}
+
+// Stable least significant digit radix sort of keys together with a 32-bit value per key, one byte of the key per pass.
+// The scratch buffers are kept between sorts, so keep one sorter around per use.
+template <std::unsigned_integral Key>
+class RadixSorter {
+public:
+    // Sorts keys and values, which must be the same size, by key. Passes whose byte is the same for every key are
+    // skipped, so keys that only use their low bits cost fewer passes.
+    void Sort(std::span<Key> keys, std::span<std::uint32_t> values, ThreadPool& threads) {
+        constexpr std::size_t MinKeysPerThread = 16384;
+
+        std::size_t count = keys.size();
+        if (count < 2)
+            return;
+        std::size_t threadCount = std::clamp<std::size_t>(count / MinKeysPerThread, 1, threads.GetThreadCount());
+
+        // Histograms of every byte over all the keys, to find the passes that can be skipped
+        ThreadCounts.assign(threadCount * PassCount * BucketCount, 0);
+        threads.Run(threadCount, [&](std::size_t thread) {
+            auto [begin, end]     = ThreadPool::GetChunk(count, threadCount, thread);
+            std::uint32_t* counts = &ThreadCounts[thread * PassCount * BucketCount];
+            for (std::size_t i = begin; i < end; i++) {
+                for (std::size_t pass = 0; pass < PassCount; pass++) {
+                    counts[pass * BucketCount + GetDigit(keys[i], pass)]++;
+                }
+            }
+        });
+        std::array<bool, PassCount> skipPass{};
+        for (std::size_t pass = 0; pass < PassCount; pass++) {
+            for (std::size_t bucket = 0; bucket < BucketCount; bucket++) {
+                std::size_t total = 0;
+                for (std::size_t thread = 0; thread < threadCount; thread++) {
+                    total += ThreadCounts[(thread * PassCount + pass) * BucketCount + bucket];
+                }
+                if (total == count)
+                    skipPass[pass] = true;
+                if (total != 0)
+                    break;
+            }
+        }
+
+        ScratchKeys.resize(count);
+        ScratchValues.resize(count);
+        std::span<Key> fromKeys             = keys;
+        std::span<std::uint32_t> fromValues = values;
+        std::span<Key> toKeys               = ScratchKeys;
+        std::span<std::uint32_t> toValues   = ScratchValues;
+        bool firstPass                      = true;
+        for (std::size_t pass = 0; pass < PassCount; pass++) {
+            if (skipPass[pass])
+                continue;
+
+            // The histograms from above only match the chunks of the current order before the first scatter
+            if (!firstPass) {
+                threads.Run(threadCount, [&](std::size_t thread) {
+                    auto [begin, end]     = ThreadPool::GetChunk(count, threadCount, thread);
+                    std::uint32_t* counts = &ThreadCounts[(thread * PassCount + pass) * BucketCount];
+                    std::fill(counts, counts + BucketCount, 0);
+                    for (std::size_t i = begin; i < end; i++) {
+                        counts[GetDigit(fromKeys[i], pass)]++;
+                    }
+                });
+            }
+            firstPass = false;
+
+            // Exclusive prefix sum over the buckets and then the threads, giving every thread its own write position
+            std::uint32_t running = 0;
+            for (std::size_t bucket = 0; bucket < BucketCount; bucket++) {
+                for (std::size_t thread = 0; thread < threadCount; thread++) {
+                    std::uint32_t& bucketCount = ThreadCounts[(thread * PassCount + pass) * BucketCount + bucket];
+                    std::uint32_t next         = running + bucketCount;
+                    bucketCount                = running;
+                    running                    = next;
+                }
+            }
+
+            threads.Run(threadCount, [&](std::size_t thread) {
+                auto [begin, end]        = ThreadPool::GetChunk(count, threadCount, thread);
+                std::uint32_t* positions = &ThreadCounts[(thread * PassCount + pass) * BucketCount];
+                for (std::size_t i = begin; i < end; i++) {
+                    std::uint32_t position = positions[GetDigit(fromKeys[i], pass)]++;
+                    toKeys[position]       = fromKeys[i];
+                    toValues[position]     = fromValues[i];
+                }
+            });
+            std::swap(fromKeys, toKeys);
+            std::swap(fromValues, toValues);
+        }
+
+        // An odd number of passes leaves the result in the scratch buffers
+        if (fromKeys.data() != keys.data()) {
+            std::copy(fromKeys.begin(), fromKeys.end(), keys.begin());
+            std::copy(fromValues.begin(), fromValues.end(), values.begin());
+        }
+    }
+private:
+    static constexpr std::size_t PassCount   = sizeof(Key);
+    static constexpr std::size_t BucketCount = 256;
+
+    std::vector<Key> ScratchKeys;
+    std::vector<std::uint32_t> ScratchValues;
+    std::vector<std::uint32_t> ThreadCounts; // ThreadCounts[(thread * PassCount + pass) * BucketCount + bucket]
+
+    static std::size_t GetDigit(Key key, std::size_t pass) {
+        return static_cast<std::size_t>((key >> (pass * 8)) & 0xFF);
+    }
+};
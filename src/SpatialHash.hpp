@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Circle.hpp"
+
+// Broad phase for unbounded or sparse worlds. Like UniformGrid the cells are at least as wide as the largest circle,
+// but only occupied cells are stored, in an open addressing hash table keyed by the integer cell coordinates.
+class SpatialHash {
+public:
+    void Build(std::span<const Circle> circles) {
+        float maxRadius = 0.0f;
+        PhysicsCircles.clear();
+        for (std::size_t i = 0; i < circles.size(); i++) {
+            if (!HasCollisions(circles[i]))
+                continue;
+            maxRadius = std::max(maxRadius, circles[i].Radius);
+            PhysicsCircles.emplace_back(static_cast<std::uint32_t>(i));
+        }
+        Build(circles, PhysicsCircles, maxRadius > 0.0f ? maxRadius * 2.0f : 1.0f);
+    }
+
+    // Only bins the given circles, cellSize must be at least the diameter of the largest of them
+    void Build(std::span<const Circle> circles, std::span<const std::uint32_t> indices, float cellSize) {
+        InverseCellSize = 1.0f / cellSize;
+
+        // At most one cell per circle, keeping the table at most half full
+        std::size_t capacity = std::bit_ceil(std::max<std::size_t>(indices.size() * 2, 16));
+        Cells.assign(capacity, Cell{});
+        SlotMask = capacity - 1;
+        OccupiedSlots.clear();
+
+        // Counting sort of the circles by cell, same as UniformGrid but the counts live in the hash table
+        CircleSlots.resize(indices.size());
+        for (std::size_t i = 0; i < indices.size(); i++) {
+            std::uint64_t key  = GetKey(GetCell(circles[indices[i]].Position));
+            std::uint32_t slot = FindSlot(key);
+            if (Cells[slot].Count == 0) {
+                Cells[slot].Key = key;
+                OccupiedSlots.emplace_back(slot);
+            }
+            Cells[slot].Count++;
+            CircleSlots[i] = slot;
+        }
+        std::uint32_t start = 0;
+        for (std::uint32_t slot : OccupiedSlots) {
+            Cells[slot].Start = start;
+            start += Cells[slot].Count;
+            Cells[slot].Count = 0;
+        }
+        CellCircles.resize(start);
+        for (std::size_t i = 0; i < indices.size(); i++) {
+            Cell& cell             = Cells[CircleSlots[i]];
+            std::uint32_t position = cell.Start + cell.Count++;
+            CellCircles[position]  = indices[i];
+        }
+    }
+
+    glm::ivec2 GetCell(glm::vec2 position) const {
+        // Keeps circles that drifted absurdly far away from overflowing the integer coordinates
+        constexpr float MaxCoordinate = static_cast<float>(1 << 30);
+        return glm::ivec2(glm::clamp(glm::floor(position * InverseCellSize), -MaxCoordinate, MaxCoordinate));
+    }
+
+    // Calls callback(circle) for every circle binned in the cell
+    template <typename Callback>
+    void ForEachCircleInCell(glm::ivec2 cell, Callback&& callback) const {
+        const Cell& found = Cells[FindSlot(GetKey(cell))];
+        for (std::uint32_t i = found.Start; i < found.Start + found.Count; i++) {
+            callback(CellCircles[i]);
+        }
+    }
+
+    // Calls callback(a, b) once for every pair of circles in the same or neighbouring cells, with a < b
+    template <typename Callback>
+    void ForEachPair(Callback&& callback) const {
+        for (std::uint32_t slot : OccupiedSlots) {
+            const Cell& cell      = Cells[slot];
+            glm::ivec2 coordinate = GetCoordinate(cell.Key);
+
+            const Cell* neighbours[9];
+            std::size_t neighbourCount = 0;
+            for (std::int32_t y = -1; y <= 1; y++) {
+                for (std::int32_t x = -1; x <= 1; x++) {
+                    std::uint32_t neighbourSlot = FindSlot(GetKey(coordinate + glm::ivec2{ x, y }));
+                    if (Cells[neighbourSlot].Count != 0)
+                        neighbours[neighbourCount++] = &Cells[neighbourSlot];
+                }
+            }
+
+            for (std::uint32_t a = cell.Start; a < cell.Start + cell.Count; a++) {
+                std::uint32_t circleA = CellCircles[a];
+                for (std::size_t n = 0; n < neighbourCount; n++) {
+                    const Cell& neighbour = *neighbours[n];
+                    for (std::uint32_t b = neighbour.Start; b < neighbour.Start + neighbour.Count; b++) {
+                        std::uint32_t circleB = CellCircles[b];
+                        if (circleA < circleB)
+                            callback(circleA, circleB);
+                    }
+                }
+            }
+        }
+    }
+private:
+    // Count is only 0 for empty slots, every stored cell has at least one circle
+    struct Cell {
+        std::uint64_t Key   = 0;
+        std::uint32_t Start = 0;
+        std::uint32_t Count = 0;
+    };
+
+    float InverseCellSize = 1.0f;
+    std::size_t SlotMask  = 0;
+    std::vector<Cell> Cells;
+    std::vector<std::uint32_t> OccupiedSlots;
+    std::vector<std::uint32_t> CellCircles;
+    std::vector<std::uint32_t> CircleSlots;
+    std::vector<std::uint32_t> PhysicsCircles;
+
+    static std::uint64_t GetKey(glm::ivec2 cell) {
+        return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(cell.x)) << 32) | static_cast<std::uint32_t>(cell.y);
+    }
+
+    static glm::ivec2 GetCoordinate(std::uint64_t key) {
+        return { static_cast<std::int32_t>(key >> 32), static_cast<std::int32_t>(key & 0xFFFFFFFF) };
+    }
+
+    // Returns the slot holding the key, or the empty slot where it would be inserted
+    std::uint32_t FindSlot(std::uint64_t key) const {
+        std::size_t slot = static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & SlotMask;
+        while (Cells[slot].Count != 0 && Cells[slot].Key != key) {
+            slot = (slot + 1) & SlotMask;
+        }
+        return static_cast<std::uint32_t>(slot);
+    }
+};
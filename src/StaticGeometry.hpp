@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Aabb.hpp"
+#include "Circle.hpp"
+
+// Segment from A to B grown by Radius, which covers lines (a radius of 0), thick walls and solid circles (A == B)
+struct StaticShape {
+    glm::vec2 A;
+    glm::vec2 B;
+    float Radius = 0.0f;
+};
+
+inline Aabb GetBounds(const StaticShape& shape) {
+    return { glm::min(shape.A, shape.B) - shape.Radius, glm::max(shape.A, shape.B) + shape.Radius };
+}
+
+// Pushes the circle out of the shape, static shapes don't move so the circle takes the whole correction
+inline void ResolveStaticCollision(Circle& circle, const StaticShape& shape) {
+    glm::vec2 segment = shape.B - shape.A;
+    float length2     = glm::dot(segment, segment);
+    float t           = length2 > 0.0f ? glm::clamp(glm::dot(circle.Position - shape.A, segment) / length2, 0.0f, 1.0f) : 0.0f;
+    glm::vec2 offset  = circle.Position - (shape.A + segment * t);
+
+    float minimumDistance = circle.Radius + shape.Radius;
+    float distance2       = glm::dot(offset, offset);
+    if (distance2 >= minimumDistance * minimumDistance)
+        return;
+    if (distance2 > 0.0f) {
+        float distance = glm::sqrt(distance2);
+        circle.Position += offset * ((minimumDistance - distance) / distance);
+    } else if (length2 > 0.0f) {
+        // Centered exactly on the segment, push it out to the segment's left
+        glm::vec2 normal = glm::vec2{ -segment.y, segment.x } / glm::sqrt(length2);
+        circle.Position += normal * minimumDistance;
+    }
+}
+
+// Bounding volume hierarchy over shapes that never move, built once after the shapes are added. Unlike AabbTree it is
+// built top down over all the shapes at once and never changes afterwards.
+class StaticGeometry {
+public:
+    void AddSegment(glm::vec2 a, glm::vec2 b, float radius = 0.0f) {
+        Shapes.emplace_back(StaticShape{ a, b, radius });
+        NeedsBuild = true;
+    }
+
+    void AddCircle(glm::vec2 center, float radius) {
+        AddSegment(center, center, radius);
+    }
+
+    // Adds the edges of the closed outline through the points, the inside of the polygon is not solid. Two points only
+    // have the one segment between them, and a single point is a circle.
+    void AddPolygon(std::span<const glm::vec2> points, float radius = 0.0f) {
+        if (points.size() < 3) {
+            if (!points.empty())
+                AddSegment(points.front(), points.back(), radius);
+            return;
+        }
+        for (std::size_t i = 0; i < points.size(); i++) {
+            AddSegment(points[i], points[(i + 1) % points.size()], radius);
+        }
+    }
+
+    bool IsEmpty() const {
+        return Shapes.empty();
+    }
+
+    const StaticShape& GetShape(std::uint32_t shape) const {
+        return Shapes[shape];
+    }
+
+    std::span<const StaticShape> GetShapes() const {
+        return Shapes;
+    }
+
+    // Only does anything after shapes were added since the last build
+    void Build() {
+        if (!NeedsBuild)
+            return;
+        NeedsBuild = false;
+
+        Nodes.clear();
+        ShapeOrder.resize(Shapes.size());
+        for (std::size_t i = 0; i < Shapes.size(); i++) {
+            ShapeOrder[i] = static_cast<std::uint32_t>(i);
+        }
+        if (Shapes.empty())
+            return;
+        Nodes.emplace_back();
+        BuildNode(0, 0, static_cast<std::uint32_t>(Shapes.size()), 0);
+    }
+
+    // Calls callback(shape) for every shape whose bounds overlap the box, Build has to be called after adding shapes
+    template <typename Callback>
+    void Query(const Aabb& box, Callback&& callback) const {
+        if (Nodes.empty())
+            return;
+
+        std::uint32_t stack[MaxDepth * 2];
+        std::size_t stackSize = 0;
+        stack[stackSize++]    = 0;
+        while (stackSize > 0) {
+            const Node& node = Nodes[stack[--stackSize]];
+            if (!node.Bounds.Overlaps(box))
+                continue;
+            if (node.Count == 0) {
+                stack[stackSize++] = node.First;
+                stack[stackSize++] = node.First + 1;
+                continue;
+            }
+            for (std::uint32_t i = node.First; i < node.First + node.Count; i++) {
+                if (GetBounds(Shapes[ShapeOrder[i]]).Overlaps(box))
+                    callback(ShapeOrder[i]);
+            }
+        }
+    }
+private:
+    static constexpr std::uint32_t MaxShapesPerLeaf = 4;
+    static constexpr std::size_t MaxDepth           = 64;
+
+    // Leaves have a Count and index into ShapeOrder, inner nodes have a Count of 0 and their children at First and First + 1
+    struct Node {
+        Aabb Bounds;
+        std::uint32_t First = 0;
+        std::uint32_t Count = 0;
+    };
+
+    bool NeedsBuild = false;
+    std::vector<StaticShape> Shapes;
+    std::vector<std::uint32_t> ShapeOrder;
+    std::vector<Node> Nodes;
+
+    // Splits the shapes at the median of their centers along the longer axis of the node, which keeps the tree balanced
+    // however the shapes are spread out. Both children are allocated together so the node only has to store the first.
+    void BuildNode(std::uint32_t node, std::uint32_t first, std::uint32_t count, std::size_t depth) {
+        Aabb bounds = GetBounds(Shapes[ShapeOrder[first]]);
+        for (std::uint32_t i = first + 1; i < first + count; i++) {
+            bounds = Aabb::Union(bounds, GetBounds(Shapes[ShapeOrder[i]]));
+        }
+        Nodes[node].Bounds = bounds;
+        if (count <= MaxShapesPerLeaf || depth + 1 >= MaxDepth) {
+            Nodes[node].First = first;
+            Nodes[node].Count = count;
+            return;
+        }
+
+        glm::vec2 size   = bounds.Max - bounds.Min;
+        std::size_t axis = size.x >= size.y ? 0 : 1;
+        auto begin       = ShapeOrder.begin() + first;
+        std::nth_element(begin, begin + count / 2, begin + count, [&](std::uint32_t a, std::uint32_t b) {
+            return Shapes[a].A[axis] + Shapes[a].B[axis] < Shapes[b].A[axis] + Shapes[b].B[axis];
+        });
+
+        std::uint32_t children = static_cast<std::uint32_t>(Nodes.size());
+        Nodes.emplace_back();
+        Nodes.emplace_back();
+        Nodes[node].First = children;
+        Nodes[node].Count = 0;
+        BuildNode(children, first, count / 2, depth + 1);
+        BuildNode(children + 1, first + count / 2, count - count / 2, depth + 1);
+    }
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Circle.hpp"
+#include "RadixSort.hpp"
+#include "ThreadPool.hpp"
+
+// Broad phase that keeps the circles' bounding boxes sorted by their lower x bound between updates. Verlet circles only
+// move a little every step, so an insertion sort brings the array back in order in close to linear time. When the
+// circles moved too much for that, the entries are radix sorted instead.
+class SweepAndPrune {
+public:
+    void Update(std::span<const Circle> circles, ThreadPool& threads) {
+        // Shifting more than this many entries per entry on average is slower than sorting from scratch
+        constexpr std::size_t MaxShiftsPerEntry = 8;
+
+        if (!MatchesCircles(circles)) {
+            Rebuild(circles, threads);
+            return;
+        }
+
+        for (Entry& entry : Entries) {
+            SetBounds(entry, circles[entry.Circle]);
+        }
+        std::size_t shiftBudget = Entries.size() * MaxShiftsPerEntry;
+        for (std::size_t i = 1; i < Entries.size(); i++) {
+            Entry entry   = Entries[i];
+            std::size_t j = i;
+            for (; j > 0 && Entries[j - 1].MinX > entry.MinX; j--) {
+                Entries[j] = Entries[j - 1];
+            }
+            Entries[j] = entry;
+
+            shiftBudget -= std::min(shiftBudget, i - j);
+            if (shiftBudget == 0) {
+                Sort(threads);
+                return;
+            }
+        }
+    }
+
+    // Calls callback(a, b) once for every pair of circles whose bounding boxes overlap, with a < b
+    template <typename Callback>
+    void ForEachPair(Callback&& callback) const {
+        for (std::size_t i = 0; i < Entries.size(); i++) {
+            const Entry& a = Entries[i];
+            for (std::size_t j = i + 1; j < Entries.size() && Entries[j].MinX <= a.MaxX; j++) {
+                const Entry& b = Entries[j];
+                if (a.MinY <= b.MaxY && b.MinY <= a.MaxY)
+                    callback(std::min(a.Circle, b.Circle), std::max(a.Circle, b.Circle));
+            }
+        }
+    }
+private:
+    struct Entry {
+        float MinX;
+        float MaxX;
+        float MinY;
+        float MaxY;
+        std::uint32_t Circle;
+    };
+    std::vector<Entry> Entries;
+    std::vector<Entry> SortedEntries;
+    std::vector<std::uint32_t> SortKeys;
+    std::vector<std::uint32_t> SortOrder;
+    RadixSorter<std::uint32_t> Sorter;
+
+    static void SetBounds(Entry& entry, const Circle& circle) {
+        entry.MinX = circle.Position.x - circle.Radius;
+        entry.MaxX = circle.Position.x + circle.Radius;
+        entry.MinY = circle.Position.y - circle.Radius;
+        entry.MaxY = circle.Position.y + circle.Radius;
+    }
+
+    // Entries can only be reused if they still hold exactly the circles with physics, which stops being true when
+    // circles are added, despawned or moved by compaction
+    bool MatchesCircles(std::span<const Circle> circles) const {
+        std::size_t physicsCircles = 0;
+        for (const Circle& circle : circles) {
+            physicsCircles += HasCollisions(circle) ? 1 : 0;
+        }
+        if (physicsCircles != Entries.size())
+            return false;
+        for (const Entry& entry : Entries) {
+            if (entry.Circle >= circles.size() || !HasCollisions(circles[entry.Circle]))
+                return false;
+        }
+        return true;
+    }
+
+    void Rebuild(std::span<const Circle> circles, ThreadPool& threads) {
+        Entries.clear();
+        for (std::size_t i = 0; i < circles.size(); i++) {
+            if (!HasCollisions(circles[i]))
+                continue;
+            Entry entry{};
+            entry.Circle = static_cast<std::uint32_t>(i);
+            SetBounds(entry, circles[i]);
+            Entries.emplace_back(entry);
+        }
+        Sort(threads);
+    }
+
+    void Sort(ThreadPool& threads) {
+        SortKeys.resize(Entries.size());
+        SortOrder.resize(Entries.size());
+        for (std::size_t i = 0; i < Entries.size(); i++) {
+            SortKeys[i]  = GetSortableKey(Entries[i].MinX);
+            SortOrder[i] = static_cast<std::uint32_t>(i);
+        }
+        Sorter.Sort(SortKeys, SortOrder, threads);
+
+        SortedEntries.resize(Entries.size());
+        for (std::size_t i = 0; i < Entries.size(); i++) {
+            SortedEntries[i] = Entries[SortOrder[i]];
+        }
+        std::swap(Entries, SortedEntries);
+    }
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Persistent worker threads for splitting a loop across cores. The threads sleep between runs, so a run costs a wake up
+// per thread, which is why callers only use more than one thread once there is enough work to make up for it.
+class ThreadPool {
+public:
+    ThreadPool()
+        : ThreadPool(std::max(std::thread::hardware_concurrency(), 1u)) {}
+
+    explicit ThreadPool(std::size_t threadCount) {
+        for (std::size_t i = 1; i < threadCount; i++) {
+            Workers.emplace_back([this, i]() {
+                WorkerLoop(i);
+            });
+        }
+    }
+
+    ThreadPool(const ThreadPool&)            = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(Mutex);
+            Stopping = true;
+        }
+        WakeUp.notify_all();
+        for (std::thread& worker : Workers) {
+            worker.join();
+        }
+    }
+
+    // Including the calling thread
+    std::size_t GetThreadCount() const {
+        return Workers.size() + 1;
+    }
+
+    // Calls task(threadIndex) once for every thread index below threadCount and returns when all of them are done,
+    // the calling thread runs index 0
+    template <typename Task>
+    void Run(std::size_t threadCount, Task&& task) {
+        threadCount = std::clamp<std::size_t>(threadCount, 1, GetThreadCount());
+        if (threadCount == 1) {
+            task(std::size_t{ 0 });
+            return;
+        }
+
+        {
+            std::lock_guard lock(Mutex);
+            TaskData      = &task;
+            TaskFunction  = &CallTask<std::remove_reference_t<Task>>;
+            ActiveThreads = threadCount;
+            PendingTasks  = threadCount - 1;
+            Generation++;
+        }
+        WakeUp.notify_all();
+        task(std::size_t{ 0 });
+
+        std::unique_lock lock(Mutex);
+        Done.wait(lock, [this]() {
+            return PendingTasks == 0;
+        });
+    }
+
+    // The range of items out of count that a thread handles when splitting them evenly between threadCount threads
+    static std::pair<std::size_t, std::size_t> GetChunk(std::size_t count, std::size_t threadCount, std::size_t threadIndex) {
+        return { count * threadIndex / threadCount, count * (threadIndex + 1) / threadCount };
+    }
+private:
+    std::vector<std::thread> Workers;
+    std::mutex Mutex;
+    std::condition_variable WakeUp;
+    std::condition_variable Done;
+    void* TaskData                           = nullptr;
+    void (*TaskFunction)(void*, std::size_t) = nullptr;
+    std::size_t ActiveThreads                = 0;
+    std::size_t PendingTasks                 = 0;
+    std::uint64_t Generation                 = 0;
+    bool Stopping                            = false;
+
+    template <typename Task>
+    static void CallTask(void* task, std::size_t threadIndex) {
+        (*static_cast<Task*>(task))(threadIndex);
+    }
+
+    void WorkerLoop(std::size_t threadIndex) {
+        std::uint64_t seenGeneration = 0;
+        std::unique_lock lock(Mutex);
+        while (true) {
+            WakeUp.wait(lock, [&]() {
+                return Stopping || Generation != seenGeneration;
+            });
+            if (Stopping)
+                return;
+            seenGeneration = Generation;
+            if (threadIndex >= ActiveThreads)
+                continue;
+
+            void (*taskFunction)(void*, std::size_t) = TaskFunction;
+            void* taskData                           = TaskData;
+            lock.unlock();
+            taskFunction(taskData, threadIndex);
+            lock.lock();
+            if (--PendingTasks == 0)
+                Done.notify_one();
+        }
+    }
+};
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Circle.hpp"
+#include "ThreadPool.hpp"
+
+// Broad phase that bins circles into square cells at least as wide as the largest circle, so two overlapping circles
+// are always in the same or neighbouring cells. Circles outside the bounds are clamped into the border cells.
+class UniformGrid {
+public:
+    struct UpdateMetrics {
+        std::size_t Builds             = 0;
+        std::size_t IncrementalUpdates = 0;
+        std::size_t MovedCircles       = 0; // Circles that changed cell in the last Update, whether or not it rebuilt
+        std::size_t TotalMovedCircles  = 0; // Summed over the incremental updates
+    };
+
+    // The counting sort is split between the pool's threads once there are enough circles to make up for waking them
+    void Build(std::span<const Circle> circles, glm::vec2 boundsMin, glm::vec2 boundsMax, ThreadPool& threads) {
+        BuildCells(circles, boundsMin, boundsMax, threads, 0);
+    }
+
+    // Keeps the cells from the last build and only moves the circles whose cell changed. Falls back to a full build,
+    // which leaves some room in every cell for circles moving in, when the grid itself has to change, a cell runs out of
+    // room, or so many circles moved that sorting them all again is cheaper.
+    void Update(std::span<const Circle> circles, glm::vec2 boundsMin, glm::vec2 boundsMax, ThreadPool& threads) {
+        constexpr std::uint32_t UpdateCellSlack = 4;
+        constexpr std::size_t MaxMovedFraction  = 8; // Rebuilds once more than 1 in this many circles moved
+
+        Metrics.MovedCircles = 0;
+        if (CellSlack == 0 || circles.size() != CircleCells.size() || boundsMin != BoundsMin || boundsMax != BoundsMax) {
+            BuildCells(circles, boundsMin, boundsMax, threads, UpdateCellSlack);
+            return;
+        }
+
+        float maxRadius = 0.0f;
+        MovedCircles.clear();
+        for (std::size_t i = 0; i < circles.size(); i++) {
+            if (HasCollisions(circles[i]))
+                maxRadius = std::max(maxRadius, circles[i].Radius);
+            if (GetCellIndex(circles[i]) != CircleCells[i])
+                MovedCircles.emplace_back(static_cast<std::uint32_t>(i));
+        }
+        Metrics.MovedCircles = MovedCircles.size();
+        if (maxRadius * 2.0f > CellSize || MovedCircles.size() * MaxMovedFraction > circles.size()) {
+            BuildCells(circles, boundsMin, boundsMax, threads, UpdateCellSlack);
+            return;
+        }
+
+        for (std::uint32_t circle : MovedCircles) {
+            RemoveFromCell(circle);
+            if (!AddToCell(circle, GetCellIndex(circles[circle]))) {
+                BuildCells(circles, boundsMin, boundsMax, threads, UpdateCellSlack);
+                return;
+            }
+        }
+        Metrics.IncrementalUpdates++;
+        Metrics.TotalMovedCircles += MovedCircles.size();
+    }
+
+    const UpdateMetrics& GetMetrics() const {
+        return Metrics;
+    }
+    // Calls callback(a, b) once for every pair of circles in the same or neighbouring cells, with a < b. Every cell is
+    // paired with itself and the half of its neighbours to the right and below, so each pair of cells is only visited once,
+    // and the cells are visited tile by tile in the order they are stored in.
+    template <typename Callback>
+    void ForEachPair(Callback&& callback) const {
+        constexpr std::int32_t HalfShell[4][2] = { { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } };
+        for (std::int32_t tileY = 0; tileY < CellsY; tileY += TileSize) {
+            for (std::int32_t tileX = 0; tileX < CellsX; tileX += TileSize) {
+                for (std::int32_t y = tileY; y < std::min(tileY + TileSize, CellsY); y++) {
+                    for (std::int32_t x = tileX; x < std::min(tileX + TileSize, CellsX); x++) {
+                        std::uint32_t cell  = GetCellIndex(glm::ivec2{ x, y });
+                        std::uint32_t begin = CellStart[cell];
+                        std::uint32_t end   = begin + CellCounts[cell];
+                        if (begin == end)
+                            continue;
+
+                        for (std::uint32_t a = begin; a < end; a++) {
+                            for (std::uint32_t b = a + 1; b < end; b++) {
+                                callback(std::min(CellCircles[a], CellCircles[b]), std::max(CellCircles[a], CellCircles[b]));
+                            }
+                        }
+                        for (const auto& offset : HalfShell) {
+                            glm::ivec2 neighbourCell{ x + offset[0], y + offset[1] };
+                            if (neighbourCell.x < 0 || neighbourCell.x >= CellsX || neighbourCell.y >= CellsY)
+                                continue;
+                            std::uint32_t neighbour      = GetCellIndex(neighbourCell);
+                            std::uint32_t neighbourBegin = CellStart[neighbour];
+                            std::uint32_t neighbourEnd   = neighbourBegin + CellCounts[neighbour];
+                            for (std::uint32_t a = begin; a < end; a++) {
+                                for (std::uint32_t b = neighbourBegin; b < neighbourEnd; b++) {
+                                    callback(std::min(CellCircles[a], CellCircles[b]), std::max(CellCircles[a], CellCircles[b]));
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+private:
+    static constexpr std::uint32_t NoCell = ~0u;
+    // Cells are stored in square tiles of this many cells per side, row by row within a tile
+    static constexpr std::int32_t TileSize = 8;
+
+    glm::vec2 BoundsMin{};
+    glm::vec2 BoundsMax{};
+    float CellSize          = 0.0f;
+    float InverseCellSize   = 0.0f;
+    std::int32_t CellsX     = 0;
+    std::int32_t CellsY     = 0;
+    std::int32_t TilesX     = 0;
+    std::uint32_t CellSlack = 0;
+    UpdateMetrics Metrics;
+    std::vector<std::uint32_t> CellStart;
+    std::vector<std::uint32_t> CellCounts;
+    std::vector<std::uint32_t> CellCircles;
+    std::vector<std::uint32_t> CircleCells;
+    std::vector<std::uint32_t> CircleSlots; // Position of every circle in CellCircles
+    std::vector<std::uint32_t> MovedCircles;
+    std::vector<std::uint32_t> ThreadCellCounts;
+    std::vector<std::uint32_t> ThreadRangeSums;
+    std::vector<float> ThreadMaxRadius;
+
+    glm::ivec2 GetCell(glm::vec2 position) const {
+        glm::ivec2 cell = glm::ivec2(glm::floor((position - BoundsMin) * InverseCellSize));
+        return glm::clamp(cell, glm::ivec2(0), glm::ivec2(CellsX - 1, CellsY - 1));
+    }
+
+    std::uint32_t GetCellIndex(glm::ivec2 cell) const {
+        glm::ivec2 tile   = cell / TileSize;
+        glm::ivec2 inTile = cell % TileSize;
+        return static_cast<std::uint32_t>(((tile.y * TilesX + tile.x) * TileSize + inTile.y) * TileSize + inTile.x);
+    }
+
+    std::uint32_t GetCellIndex(const Circle& circle) const {
+        if (!HasCollisions(circle))
+            return NoCell;
+        return GetCellIndex(GetCell(circle.Position));
+    }
+
+    void BuildCells(std::span<const Circle> circles,
+                    glm::vec2 boundsMin,
+                    glm::vec2 boundsMax,
+                    ThreadPool& threads,
+                    std::uint32_t cellSlack) {
+        constexpr std::int32_t MaxCellsPerAxis    = 1024;
+        constexpr std::size_t MinCirclesPerThread = 8192;
+
+        std::size_t threadCount = std::clamp<std::size_t>(circles.size() / MinCirclesPerThread, 1, threads.GetThreadCount());
+        ThreadMaxRadius.assign(threadCount, 0.0f);
+        threads.Run(threadCount, [&](std::size_t thread) {
+            auto [begin, end] = ThreadPool::GetChunk(circles.size(), threadCount, thread);
+            for (std::size_t i = begin; i < end; i++) {
+                if (HasCollisions(circles[i]))
+                    ThreadMaxRadius[thread] = std::max(ThreadMaxRadius[thread], circles[i].Radius);
+            }
+        });
+        float maxRadius = *std::max_element(ThreadMaxRadius.begin(), ThreadMaxRadius.end());
+
+        glm::vec2 size  = boundsMax - boundsMin;
+        CellSize        = std::max(maxRadius * 2.0f, std::max(size.x, size.y) / static_cast<float>(MaxCellsPerAxis));
+        CellSlack       = cellSlack;
+        BoundsMin       = boundsMin;
+        BoundsMax       = boundsMax;
+        InverseCellSize = CellSize > 0.0f ? 1.0f / CellSize : 0.0f;
+        CellsX          = std::clamp(static_cast<std::int32_t>(glm::ceil(size.x * InverseCellSize)), 1, MaxCellsPerAxis);
+        CellsY          = std::clamp(static_cast<std::int32_t>(glm::ceil(size.y * InverseCellSize)), 1, MaxCellsPerAxis);
+        TilesX          = (CellsX + TileSize - 1) / TileSize;
+
+        // Counting sort of the circles by cell, CellStart[cell] .. CellStart[cell] + CellCounts[cell] indexes into CellCircles
+        // and is followed by cellSlack free slots. Every thread counts its chunk of the circles into its own histogram,
+        // ThreadCellCounts[thread * cellCount + cell].
+        // Cells past the edge of the grid in the last row and column of tiles stay empty
+        std::int32_t tilesY   = (CellsY + TileSize - 1) / TileSize;
+        std::size_t cellCount = static_cast<std::size_t>(TilesX) * tilesY * TileSize * TileSize;
+        CellStart.resize(cellCount + 1);
+        CellCounts.resize(cellCount);
+        CircleSlots.resize(circles.size());
+        CircleCells.resize(circles.size());
+        ThreadCellCounts.assign(threadCount * cellCount, 0);
+        threads.Run(threadCount, [&](std::size_t thread) {
+            auto [begin, end]     = ThreadPool::GetChunk(circles.size(), threadCount, thread);
+            std::uint32_t* counts = &ThreadCellCounts[thread * cellCount];
+            for (std::size_t i = begin; i < end; i++) {
+                CircleCells[i] = GetCellIndex(circles[i]);
+                if (CircleCells[i] != NoCell)
+                    counts[CircleCells[i]]++;
+            }
+        });
+
+        // Exclusive prefix sum over the cells and then the threads within each cell, so every thread ends up with its own
+        // write position in every cell and the circles stay in index order within a cell. The cells are split between the
+        // threads, each of them sums its range and then offsets it by the sums of the ranges before it.
+        ThreadRangeSums.assign(threadCount + 1, 0);
+        threads.Run(threadCount, [&](std::size_t thread) {
+            auto [begin, end] = ThreadPool::GetChunk(cellCount, threadCount, thread);
+            std::uint32_t sum = 0;
+            for (std::size_t cell = begin; cell < end; cell++) {
+                for (std::size_t countThread = 0; countThread < threadCount; countThread++) {
+                    sum += ThreadCellCounts[countThread * cellCount + cell];
+                }
+                sum += cellSlack;
+            }
+            ThreadRangeSums[thread + 1] = sum;
+        });
+        for (std::size_t thread = 1; thread <= threadCount; thread++) {
+            ThreadRangeSums[thread] += ThreadRangeSums[thread - 1];
+        }
+        threads.Run(threadCount, [&](std::size_t thread) {
+            auto [begin, end]     = ThreadPool::GetChunk(cellCount, threadCount, thread);
+            std::uint32_t running = ThreadRangeSums[thread];
+            for (std::size_t cell = begin; cell < end; cell++) {
+                CellStart[cell] = running;
+                for (std::size_t countThread = 0; countThread < threadCount; countThread++) {
+                    std::uint32_t& count = ThreadCellCounts[countThread * cellCount + cell];
+                    std::uint32_t next   = running + count;
+                    count                = running;
+                    running              = next;
+                }
+                CellCounts[cell] = running - CellStart[cell];
+                running += cellSlack;
+            }
+        });
+        CellStart[cellCount] = ThreadRangeSums[threadCount];
+
+        // Scatter, with the same chunks as the counting pass
+        CellCircles.resize(CellStart[cellCount]);
+        threads.Run(threadCount, [&](std::size_t thread) {
+            auto [begin, end]        = ThreadPool::GetChunk(circles.size(), threadCount, thread);
+            std::uint32_t* positions = &ThreadCellCounts[thread * cellCount];
+            for (std::size_t i = begin; i < end; i++) {
+                if (CircleCells[i] == NoCell)
+                    continue;
+                CircleSlots[i]              = positions[CircleCells[i]]++;
+                CellCircles[CircleSlots[i]] = static_cast<std::uint32_t>(i);
+            }
+        });
+        Metrics.Builds++;
+    }
+
+    // Fills the circle's slot with the last circle of its cell
+    void RemoveFromCell(std::uint32_t circle) {
+        std::uint32_t cell = CircleCells[circle];
+        if (cell == NoCell)
+            return;
+        std::uint32_t last               = CellCircles[CellStart[cell] + --CellCounts[cell]];
+        CellCircles[CircleSlots[circle]] = last;
+        CircleSlots[last]                = CircleSlots[circle];
+        CircleCells[circle]              = NoCell;
+    }
+
+    // Returns false if the cell has no room left
+    bool AddToCell(std::uint32_t circle, std::uint32_t cell) {
+        if (cell == NoCell)
+            return true;
+        if (CellStart[cell] + CellCounts[cell] == CellStart[cell + 1])
+            return false;
+        CircleSlots[circle]              = CellStart[cell] + CellCounts[cell]++;
+        CellCircles[CircleSlots[circle]] = circle;
+        CircleCells[circle]              = cell;
+        return true;
+    }
+};